@@ -0,0 +1,481 @@
+/**
+ * Parallel VLSI Wire Routing, shared core
+ *
+ * Data model, walkers, candidate enumeration and annealing policy used by
+ * every backend (serial, OpenMP, std::thread and MPI)
+ */
+
+#ifndef __ROUTING_CORE_H__
+#define __ROUTING_CORE_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+struct Point {
+    int x, y;
+};
+inline bool operator==(const Point &lhs, const Point &rhs) { return lhs.x == rhs.x && lhs.y == rhs.y; }
+inline bool operator!=(const Point &lhs, const Point &rhs) { return !(lhs == rhs); }
+
+inline int signX(const Point &p1, const Point &p2) { return p2.x >= p1.x ? +1 : -1; }
+inline int signY(const Point &p1, const Point &p2) { return p2.y >= p1.y ? +1 : -1; }
+
+struct Wire {
+    Point start, end;
+    int id;
+    // Number of candidate routes times their length, used to balance ranks
+    uint64_t computation_cost = (uint64_t)(abs(end.x - start.x) + abs(end.y - start.y)) *
+                                (abs(end.x - start.x) + abs(end.y - start.y) + 1);
+    inline int signX() { return ::signX(start, end); }
+    inline int signY() { return ::signY(start, end); }
+};
+
+typedef int cost_t;
+#define MAX_COST INT32_MAX
+
+struct Metrics {
+    cost_t max_cost_value;
+    cost_t sum_cost_values;
+
+    Metrics(cost_t max_cost_value = 0, cost_t sum_cost_values = 0) : max_cost_value(max_cost_value), sum_cost_values(sum_cost_values) {}
+
+    void update(cost_t new_cost) {
+        this->max_cost_value = std::max(this->max_cost_value, new_cost);
+        this->sum_cost_values += new_cost;
+    }
+
+    void update(Metrics new_metrics) {
+        this->max_cost_value = std::max(this->max_cost_value, new_metrics.max_cost_value);
+        this->sum_cost_values += new_metrics.sum_cost_values;
+    }
+};
+
+struct Route {
+    Wire wire;
+    Point p1, p2;
+    Metrics metrics = Metrics{MAX_COST, MAX_COST};
+    Route() : wire() {}
+    explicit Route(Wire wire) : wire(wire) {}
+};
+
+inline bool operator<(const Metrics &lhs, const Metrics &rhs) {
+    if (lhs.max_cost_value != rhs.max_cost_value)
+        return lhs.max_cost_value < rhs.max_cost_value;
+    return lhs.sum_cost_values < rhs.sum_cost_values;
+}
+
+inline std::ostream &operator<<(std::ostream &os, const Metrics &metrics) {
+    os << "Max cost: " << metrics.max_cost_value << ", Sum cost: " << metrics.sum_cost_values << "";
+    return os;
+}
+
+inline std::ostream &operator<<(std::ostream &os, const Point &p) {
+    os << p.x << " " << p.y;
+    return os;
+}
+
+inline std::ostream &operator<<(std::ostream &os, const Wire &wire) {
+    os << wire.start << " " << wire.end;
+    return os;
+}
+
+inline std::ostream &operator<<(std::ostream &os, const Route &route) {
+    os << route.wire.start << " ";
+    if (route.p1 != route.wire.start)
+        os << route.p1 << " ";
+    if (route.p2 != route.p1)
+        os << route.p2 << " ";
+    os << route.wire.end;
+    return os;
+}
+
+/* Objectives: how the cost of each cell enters a score and how two scores rank.
+ * Each is a policy of static functions passed to the walkers and candidate
+ * reductions as a template parameter, so scoring loops inline it. Scores keep
+ * the peak occupancy in max_cost_value and the weighed cells in sum_cost_values,
+ * which merge the same way under every objective. An empty cell must leave a
+ * score unchanged, so that walkers may skip untouched parts of a grid. */
+
+// Lowest peak first, then the lowest total; the original objective
+struct MaxThenSum {
+    static void update(Metrics &metrics, cost_t cost) { metrics.update(cost); }
+    static bool less(const Metrics &lhs, const Metrics &rhs) { return lhs < rhs; }
+};
+
+// Lowest total plus max_weight times the peak, trading a higher peak for a shorter route
+template <int max_weight>
+struct WeightedSum {
+    static void update(Metrics &metrics, cost_t cost) { metrics.update(cost); }
+    static bool less(const Metrics &lhs, const Metrics &rhs) {
+        return lhs.sum_cost_values + (int64_t)max_weight * lhs.max_cost_value <
+               rhs.sum_cost_values + (int64_t)max_weight * rhs.max_cost_value;
+    }
+};
+
+// Every wire a cell carries beyond capacity costs penalty on top of its occupancy
+template <int capacity, int penalty>
+struct CapacityOverflow {
+    static void update(Metrics &metrics, cost_t cost) {
+        metrics.max_cost_value = std::max(metrics.max_cost_value, cost);
+        metrics.sum_cost_values += cost + penalty * std::max(cost - capacity, 0);
+    }
+    static bool less(const Metrics &lhs, const Metrics &rhs) {
+        if (lhs.sum_cost_values != rhs.sum_cost_values)
+            return lhs.sum_cost_values < rhs.sum_cost_values;
+        return lhs.max_cost_value < rhs.max_cost_value;
+    }
+};
+
+#define OBJECTIVE_MAX_WEIGHT 8
+#define OBJECTIVE_CAPACITY 4
+#define OBJECTIVE_OVERFLOW_PENALTY 16
+
+enum ObjectiveKind { OBJECTIVE_MAX_SUM, OBJECTIVE_WEIGHTED, OBJECTIVE_OVERFLOW };
+
+inline bool parse_objective(const std::string &name, ObjectiveKind *kind) {
+    if (name == "max-sum")
+        *kind = OBJECTIVE_MAX_SUM;
+    else if (name == "weighted")
+        *kind = OBJECTIVE_WEIGHTED;
+    else if (name == "overflow")
+        *kind = OBJECTIVE_OVERFLOW;
+    else
+        return false;
+    return true;
+}
+
+// Calls f with the built-in policy chosen at run time. Callers switch once per
+// wire, never per cell.
+template <class F>
+inline auto with_objective(ObjectiveKind kind, F f) -> decltype(f(MaxThenSum())) {
+    switch (kind) {
+    case OBJECTIVE_WEIGHTED:
+        return f(WeightedSum<OBJECTIVE_MAX_WEIGHT>());
+    case OBJECTIVE_OVERFLOW:
+        return f(CapacityOverflow<OBJECTIVE_CAPACITY, OBJECTIVE_OVERFLOW_PENALTY>());
+    default:
+        return f(MaxThenSum());
+    }
+}
+
+/* Runtime CPU dispatch. Walking a contiguous row of cells is the one walker
+ * loop that vectorizes, so walk_row is built once per instruction set below
+ * and picked at startup from cpuid. Strided column walks are bound by a cache
+ * line per cell and atomic walks by their locked adds, so neither gains from
+ * wider vectors. active_isa can be overridden to benchmark the variants, but
+ * only with one the CPU supports. */
+
+enum Isa { ISA_DEFAULT, ISA_SSE42, ISA_AVX2, ISA_AVX512 };
+
+inline bool isa_supported(Isa isa) {
+    __builtin_cpu_init();
+    switch (isa) {
+    case ISA_SSE42:
+        return __builtin_cpu_supports("sse4.2");
+    case ISA_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case ISA_AVX512:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl");
+    default:
+        return true;
+    }
+}
+
+inline Isa detect_isa() {
+    for (Isa isa : {ISA_AVX512, ISA_AVX2, ISA_SSE42})
+        if (isa_supported(isa))
+            return isa;
+    return ISA_DEFAULT;
+}
+
+inline Isa &active_isa() {
+    static Isa isa = detect_isa();
+    return isa;
+}
+
+inline const char *isa_name(Isa isa) {
+    static const char *names[] = {"default", "sse4.2", "avx2", "avx512"};
+    return names[isa];
+}
+
+inline bool parse_isa(const std::string &name, Isa *isa) {
+    for (Isa candidate : {ISA_DEFAULT, ISA_SSE42, ISA_AVX2, ISA_AVX512}) {
+        if (name == isa_name(candidate)) {
+            *isa = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Walkers specialized at compile time on the axis of a segment and on what they
+ * do to each cell, so the inner loops carry neither branches nor dead stores.
+ * The atomic modes use compiler builtins rather than OpenMP pragmas, so they
+ * hold for OpenMP threads, std::threads and ranks sharing a window alike. */
+
+enum WalkAxis { AXIS_X, AXIS_Y };
+enum WalkMode { WALK_SCORE, WALK_ADD, WALK_REMOVE, WALK_ATOMIC_SCORE, WALK_ATOMIC_ADD, WALK_ATOMIC_REMOVE };
+
+template <WalkMode mode>
+inline cost_t walk_cell(cost_t *cell) {
+    switch (mode) {
+    case WALK_SCORE:
+        return *cell;
+    case WALK_ADD:
+        return ++*cell;
+    case WALK_REMOVE:
+        return --*cell;
+    case WALK_ATOMIC_SCORE:
+        return __atomic_load_n(cell, __ATOMIC_RELAXED);
+    case WALK_ATOMIC_ADD:
+        return __atomic_add_fetch(cell, 1, __ATOMIC_SEQ_CST);
+    case WALK_ATOMIC_REMOVE:
+        return __atomic_sub_fetch(cell, 1, __ATOMIC_SEQ_CST);
+    }
+    return *cell;
+}
+
+constexpr bool is_scoring(WalkMode mode) { return mode == WALK_SCORE || mode == WALK_ATOMIC_SCORE; }
+constexpr bool is_atomic(WalkMode mode) { return mode >= WALK_ATOMIC_SCORE; }
+
+// Walks n cells from cells on; a row walks the same in either direction
+template <WalkMode mode, class Objective>
+inline Metrics walk_row_body(cost_t *cells, int n) {
+    Metrics metrics_of_row;
+    for (int i = 0; i < n; ++i)
+        Objective::update(metrics_of_row, walk_cell<mode>(cells + i));
+    return metrics_of_row;
+}
+
+template <WalkMode mode, class Objective>
+__attribute__((target("sse4.2"), flatten)) Metrics walk_row_sse42(cost_t *cells, int n) { return walk_row_body<mode, Objective>(cells, n); }
+
+template <WalkMode mode, class Objective>
+__attribute__((target("avx2"), flatten)) Metrics walk_row_avx2(cost_t *cells, int n) { return walk_row_body<mode, Objective>(cells, n); }
+
+template <WalkMode mode, class Objective>
+__attribute__((target("avx512f,avx512bw,avx512vl"), flatten)) Metrics walk_row_avx512(cost_t *cells, int n) { return walk_row_body<mode, Objective>(cells, n); }
+
+template <WalkMode mode, class Objective>
+inline Metrics walk_row(cost_t *cells, int n) {
+    if (is_atomic(mode))
+        return walk_row_body<mode, Objective>(cells, n);
+    switch (active_isa()) {
+    case ISA_AVX512:
+        return walk_row_avx512<mode, Objective>(cells, n);
+    case ISA_AVX2:
+        return walk_row_avx2<mode, Objective>(cells, n);
+    case ISA_SSE42:
+        return walk_row_sse42<mode, Objective>(cells, n);
+    default:
+        return walk_row_body<mode, Objective>(cells, n);
+    }
+}
+
+// Walks [p1, p2) along one axis
+template <WalkAxis axis, WalkMode mode, class Objective = MaxThenSum>
+inline Metrics walk_line(int dim_x, cost_t *costs, Point p1, Point p2) {
+    if (axis == AXIS_X && !is_atomic(mode)) {
+        int first = std::min(p1.x, p2.x + (p2.x > p1.x ? 0 : 1));
+        return walk_row<mode, Objective>(costs + p1.y * dim_x + first, abs(p2.x - p1.x));
+    }
+
+    Metrics metrics_of_line;
+    int step = axis == AXIS_X ? signX(p1, p2) : signY(p1, p2) * dim_x;
+    cost_t *cell = costs + p1.y * dim_x + p1.x;
+    cost_t *last = costs + p2.y * dim_x + p2.x;
+    for (; cell != last; cell += step)
+        Objective::update(metrics_of_line, walk_cell<mode>(cell));
+    return metrics_of_line;
+}
+
+template <WalkMode mode, class Objective = MaxThenSum>
+inline Metrics walk_segment(int dim_x, cost_t *costs, Point p1, Point p2) {
+    if (p1.x == p2.x)
+        return walk_line<AXIS_Y, mode, Objective>(dim_x, costs, p1, p2);
+    return walk_line<AXIS_X, mode, Objective>(dim_x, costs, p1, p2);
+}
+
+template <WalkMode mode, class Objective = MaxThenSum>
+inline Metrics walk_route(int dim_x, cost_t *costs, const Route &route) {
+    Metrics metrics_of_route;
+
+    metrics_of_route.update(walk_segment<mode, Objective>(dim_x, costs, route.wire.start, route.p1));
+    metrics_of_route.update(walk_segment<mode, Objective>(dim_x, costs, route.p1, route.p2));
+    metrics_of_route.update(walk_segment<mode, Objective>(dim_x, costs, route.p2, route.wire.end));
+    // arrive at terminal point
+    Objective::update(metrics_of_route, walk_cell<mode>(costs + route.wire.end.y * dim_x + route.wire.end.x));
+
+    return metrics_of_route;
+}
+
+/* Sparse cost grid: SPARSE_TILE x SPARSE_TILE tiles allocated on first write
+ * behind a directory of tile pointers. Each tile also keeps the sum of its
+ * cells, so a tile never written or emptied again reads as zero and scoring
+ * walks step over it without touching its cells. */
+
+#define SPARSE_TILE_SHIFT 5
+#define SPARSE_TILE (1 << SPARSE_TILE_SHIFT)
+
+struct SparseGrid {
+    int dim_x, dim_y;
+    int tiles_x, tiles_y;
+    cost_t **tiles;
+    int *loads;
+};
+
+inline SparseGrid make_sparse_grid(int dim_x, int dim_y) {
+    int tiles_x = (dim_x + SPARSE_TILE - 1) >> SPARSE_TILE_SHIFT;
+    int tiles_y = (dim_y + SPARSE_TILE - 1) >> SPARSE_TILE_SHIFT;
+    cost_t **tiles = (cost_t **)calloc(tiles_x * tiles_y, sizeof(cost_t *));
+    int *loads = (int *)calloc(tiles_x * tiles_y, sizeof(int));
+    return {dim_x, dim_y, tiles_x, tiles_y, tiles, loads};
+}
+
+inline void free_sparse_grid(SparseGrid &grid) {
+    for (int tile = 0; tile < grid.tiles_x * grid.tiles_y; ++tile)
+        free(grid.tiles[tile]);
+    free(grid.tiles);
+    free(grid.loads);
+    grid = SparseGrid();
+}
+
+
+template <WalkMode mode>
+inline bool is_untouched(const SparseGrid &grid, int tile) {
+    if (is_atomic(mode))
+        return !__atomic_load_n(&grid.tiles[tile], __ATOMIC_ACQUIRE) || __atomic_load_n(&grid.loads[tile], __ATOMIC_RELAXED) == 0;
+    return !grid.tiles[tile] || grid.loads[tile] == 0;
+}
+
+// Tile to write, allocated on first use; racing writers keep the first tile
+template <WalkMode mode>
+inline cost_t *sparse_tile(SparseGrid &grid, int tile) {
+    cost_t *cells = is_atomic(mode) ? __atomic_load_n(&grid.tiles[tile], __ATOMIC_ACQUIRE) : grid.tiles[tile];
+    if (cells)
+        return cells;
+    cells = (cost_t *)calloc(SPARSE_TILE * SPARSE_TILE, sizeof(cost_t));
+    if (!is_atomic(mode))
+        return grid.tiles[tile] = cells;
+    cost_t *expected = nullptr;
+    if (__atomic_compare_exchange_n(&grid.tiles[tile], &expected, cells, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return cells;
+    free(cells);
+    return expected;
+}
+
+template <WalkMode mode>
+inline void update_load(SparseGrid &grid, int tile, int cells) {
+    if (mode == WALK_ADD)
+        grid.loads[tile] += cells;
+    else if (mode == WALK_REMOVE)
+        grid.loads[tile] -= cells;
+    else if (mode == WALK_ATOMIC_ADD)
+        __atomic_add_fetch(&grid.loads[tile], cells, __ATOMIC_RELAXED);
+    else if (mode == WALK_ATOMIC_REMOVE)
+        __atomic_sub_fetch(&grid.loads[tile], cells, __ATOMIC_RELAXED);
+}
+
+inline cost_t sparse_at(const SparseGrid &grid, int x, int y) {
+    const cost_t *cells = grid.tiles[(y >> SPARSE_TILE_SHIFT) * grid.tiles_x + (x >> SPARSE_TILE_SHIFT)];
+    return cells ? cells[(y & (SPARSE_TILE - 1)) * SPARSE_TILE + (x & (SPARSE_TILE - 1))] : 0;
+}
+
+// Walks [p1, p2) along one axis, one run of cells per tile
+template <WalkAxis axis, WalkMode mode, class Objective = MaxThenSum>
+inline Metrics walk_line(SparseGrid &grid, Point p1, Point p2) {
+    Metrics metrics_of_line;
+    int step = axis == AXIS_X ? signX(p1, p2) : signY(p1, p2);
+    int pos = axis == AXIS_X ? p1.x : p1.y, last = axis == AXIS_X ? p2.x : p2.y;
+    int across = axis == AXIS_X ? p1.y : p1.x;
+    int stride = axis == AXIS_X ? step : step * SPARSE_TILE;
+    while (pos != last) {
+        int tile_pos = pos >> SPARSE_TILE_SHIFT;
+        int edge = step > 0 ? std::min((tile_pos + 1) << SPARSE_TILE_SHIFT, last) : std::max((tile_pos << SPARSE_TILE_SHIFT) - 1, last);
+        int run = abs(edge - pos);
+        int tile = axis == AXIS_X ? (across >> SPARSE_TILE_SHIFT) * grid.tiles_x + tile_pos : tile_pos * grid.tiles_x + (across >> SPARSE_TILE_SHIFT);
+        if (!is_scoring(mode) || !is_untouched<mode>(grid, tile)) {
+            int x = axis == AXIS_X ? pos : across, y = axis == AXIS_X ? across : pos;
+            cost_t *cell = sparse_tile<mode>(grid, tile) + (y & (SPARSE_TILE - 1)) * SPARSE_TILE + (x & (SPARSE_TILE - 1));
+            if (axis == AXIS_X && !is_atomic(mode))
+                metrics_of_line.update(walk_row<mode, Objective>(step > 0 ? cell : cell - run + 1, run));
+            else
+                for (int i = 0; i != run; ++i, cell += stride)
+                    Objective::update(metrics_of_line, walk_cell<mode>(cell));
+            update_load<mode>(grid, tile, run);
+        }
+        pos = edge;
+    }
+    return metrics_of_line;
+}
+
+template <WalkMode mode, class Objective = MaxThenSum>
+inline Metrics walk_segment(SparseGrid &grid, Point p1, Point p2) {
+    if (p1.x == p2.x)
+        return walk_line<AXIS_Y, mode, Objective>(grid, p1, p2);
+    return walk_line<AXIS_X, mode, Objective>(grid, p1, p2);
+}
+
+template <WalkMode mode, class Objective = MaxThenSum>
+inline Metrics walk_route(SparseGrid &grid, const Route &route) {
+    Metrics metrics_of_route;
+
+    metrics_of_route.update(walk_segment<mode, Objective>(grid, route.wire.start, route.p1));
+    metrics_of_route.update(walk_segment<mode, Objective>(grid, route.p1, route.p2));
+    metrics_of_route.update(walk_segment<mode, Objective>(grid, route.p2, route.wire.end));
+    // arrive at terminal point
+    Point end = route.wire.end;
+    metrics_of_route.update(walk_line<AXIS_X, mode, Objective>(grid, end, {end.x + 1, end.y}));
+
+    return metrics_of_route;
+}
+
+/* Candidates of a wire are indexed rather than materialized, so the routing
+ * loops never touch the heap: first the routes that cross over on each row
+ * from start.y towards end.y, then those crossing on each column */
+
+inline int num_of_candidates(Wire wire) { return abs(wire.end.y - wire.start.y) + abs(wire.end.x - wire.start.x); }
+
+inline Route candidate_route(Wire wire, int route_id) {
+    Route route(wire);
+    int num_of_rows = abs(wire.end.y - wire.start.y);
+    if (route_id < num_of_rows) {
+        int y = wire.start.y + route_id * wire.signY();
+        route.p1 = {wire.start.x, y};
+        route.p2 = {wire.end.x, y};
+    } else {
+        int x = wire.start.x + (route_id - num_of_rows) * wire.signX();
+        route.p1 = {x, wire.start.y};
+        route.p2 = {x, wire.end.y};
+    }
+    return route;
+}
+
+/* Annealing policy: with probability SA_prob a wire takes a random L or Z
+ * shaped route instead of its best candidate */
+
+inline bool is_random_route(double SA_prob) { return (rand() % 100) <= (SA_prob * 100); }
+
+inline Route generate_random_route(Wire wire) {
+    Route route(wire);
+
+    int dx = wire.end.x - wire.start.x;
+    int dy = wire.end.y - wire.start.y;
+
+    bool vertical_first = rand() % 2;
+    float p = (rand() % 100) / 100.f;
+
+    if (vertical_first) {
+        route.p1 = {wire.start.x, wire.start.y + int(p * dy)};
+        route.p2 = {wire.end.x, route.p1.y};
+    } else {
+        route.p1 = {wire.start.x + int(p * dx), wire.start.y};
+        route.p2 = {route.p1.x, wire.end.y};
+    }
+    return route;
+}
+
+#endif
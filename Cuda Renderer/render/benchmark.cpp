@@ -2,6 +2,7 @@
 #include <math.h>
 
 #include "circleRenderer.h"
+#include "cpuDispatch.h"
 #include "cycleTimer.h"
 #include "image.h"
 #include "ppm.h"
@@ -159,7 +160,12 @@ CheckBenchmark(
         cuda_renderer->advanceAnimation();
         double endAdvanceTime = CycleTimer::currentSeconds(); 
 
+        // The reference always runs the scalar kernels, so the check
+        // also covers the SIMD kernels a CPU renderer under test runs.
+        CpuIsa isa = activeCpuIsa();
+        activeCpuIsa() = CPU_ISA_DEFAULT;
         ref_renderer->render();
+        activeCpuIsa() = isa;
         double startRenderTime = CycleTimer::currentSeconds();
         cuda_renderer->render();
         double endRenderTime = CycleTimer::currentSeconds();
@@ -0,0 +1,68 @@
+#ifndef __CPU_DISPATCH_H__
+#define __CPU_DISPATCH_H__
+
+#include <string.h>
+
+// Instruction sets the hot CPU kernels are built for.  Each kernel is
+// compiled once per set with a target attribute, so the rest of the
+// program keeps the baseline -m64 flags, and the variant to run is
+// picked at startup from cpuid.  The choice can be overridden to
+// benchmark the variants, but only with a set the CPU supports.
+typedef enum {
+    CPU_ISA_DEFAULT,
+    CPU_ISA_SSE42,
+    CPU_ISA_AVX2,
+    CPU_ISA_AVX512
+} CpuIsa;
+
+// AVX-512 implies FMA, and contracting the shading math into fused
+// multiply-adds would shift pixels off the reference image, so the
+// variant keeps separate multiplies and adds like the other sets.
+#define CPU_TARGET_SSE42 __attribute__((target("sse4.2"), flatten))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2"), flatten))
+#define CPU_TARGET_AVX512 \
+    __attribute__((target("avx512f,avx512bw,avx512vl"), optimize("fp-contract=off"), flatten))
+
+inline bool cpuIsaSupported(CpuIsa isa) {
+    __builtin_cpu_init();
+    switch (isa) {
+    case CPU_ISA_SSE42:
+        return __builtin_cpu_supports("sse4.2");
+    case CPU_ISA_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case CPU_ISA_AVX512:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+               __builtin_cpu_supports("avx512vl");
+    default:
+        return true;
+    }
+}
+
+inline CpuIsa &activeCpuIsa() {
+    static CpuIsa isa = cpuIsaSupported(CPU_ISA_AVX512) ? CPU_ISA_AVX512
+                        : cpuIsaSupported(CPU_ISA_AVX2) ? CPU_ISA_AVX2
+                        : cpuIsaSupported(CPU_ISA_SSE42) ? CPU_ISA_SSE42
+                                                         : CPU_ISA_DEFAULT;
+    return isa;
+}
+
+inline const char *cpuIsaName(CpuIsa isa) {
+    static const char *names[] = {"default", "sse4.2", "avx2", "avx512"};
+    return names[isa];
+}
+
+// Makes the named set the active one.  Returns false, leaving the
+// active set alone, when the name is unknown or the CPU lacks the set.
+inline bool selectCpuIsa(const char *name) {
+    for (int isa = CPU_ISA_DEFAULT; isa <= CPU_ISA_AVX512; isa++) {
+        if (strcmp(name, cpuIsaName(static_cast<CpuIsa>(isa))) == 0) {
+            if (!cpuIsaSupported(static_cast<CpuIsa>(isa)))
+                return false;
+            activeCpuIsa() = static_cast<CpuIsa>(isa);
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
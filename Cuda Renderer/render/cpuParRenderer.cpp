@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <omp.h>
+
+#include "cpuParRenderer.h"
+#include "image.h"
+
+// circleInBox --
+//
+// Same test as circleInBox in circleBoxTest.cu_inl: is any point of the
+// box [boxL, boxR] x [boxB, boxT] within the circle?
+static inline int
+circleInBox(
+    float circleX, float circleY, float circleRadius,
+    float boxL, float boxR, float boxT, float boxB) {
+
+    // clamp circle center to box (finds the closest point on the box)
+    float closestX = (circleX > boxL) ? ((circleX < boxR) ? circleX : boxR) : boxL;
+    float closestY = (circleY > boxB) ? ((circleY < boxT) ? circleY : boxT) : boxB;
+
+    // is circle radius less than the distance to the closest point on
+    // the box?
+    float distX = closestX - circleX;
+    float distY = closestY - circleY;
+
+    return ((distX * distX) + (distY * distY)) <= (circleRadius * circleRadius);
+}
+
+CpuParRenderer::CpuParRenderer() {
+    tilesX = 0;
+    tilesY = 0;
+}
+
+CpuParRenderer::~CpuParRenderer() {
+}
+
+// forEachTile --
+//
+// Calls f with every tile whose pixel centers the circle may cover.
+// Tiles are tested like the blocks of kernelRenderPerBlock, on the
+// box spanned by the centers of their corner pixels.
+template <typename F>
+void CpuParRenderer::forEachTile(int circleIndex, F f) {
+
+    int screenMinX, screenMaxX, screenMinY, screenMaxY;
+    if (!circleScreenBox(circleIndex, screenMinX, screenMaxX, screenMinY, screenMaxY))
+        return;
+
+    float invWidth = 1.f / image->width;
+    float invHeight = 1.f / image->height;
+
+    float px = position[3 * circleIndex];
+    float py = position[3 * circleIndex + 1];
+    float rad = radius[circleIndex];
+
+    for (int tileY = screenMinY / TILE_WIDTH; tileY <= (screenMaxY - 1) / TILE_WIDTH; tileY++) {
+        int tileB = tileY * TILE_WIDTH;
+        int tileT = std::min(tileB + TILE_WIDTH, image->height);
+        float tilePosB = invHeight * (static_cast<float>(tileB) + 0.5f);
+        float tilePosT = invHeight * (static_cast<float>(tileT - 1) + 0.5f);
+
+        for (int tileX = screenMinX / TILE_WIDTH; tileX <= (screenMaxX - 1) / TILE_WIDTH; tileX++) {
+            int tileL = tileX * TILE_WIDTH;
+            int tileR = std::min(tileL + TILE_WIDTH, image->width);
+            float tilePosL = invWidth * (static_cast<float>(tileL) + 0.5f);
+            float tilePosR = invWidth * (static_cast<float>(tileR - 1) + 0.5f);
+
+            if (circleInBox(px, py, rad, tilePosL, tilePosR, tilePosT, tilePosB))
+                f(tileY * tilesX + tileX);
+        }
+    }
+}
+
+// binCircles --
+//
+// Builds the per tile circle lists.  Each thread takes a contiguous
+// range of circles and counts how many land in every tile, an
+// exclusive scan over (tile, thread) turns the counts into write
+// offsets, and each thread then writes its circles in order.  A tile's
+// list is thus sorted by circle index, as the blending order requires.
+void CpuParRenderer::binCircles() {
+
+    tilesX = (image->width + TILE_WIDTH - 1) / TILE_WIDTH;
+    tilesY = (image->height + TILE_WIDTH - 1) / TILE_WIDTH;
+    int numTiles = tilesX * tilesY;
+    tileOffsets.resize(numTiles + 1);
+
+#pragma omp parallel
+    {
+        int thread = omp_get_thread_num();
+        int numThreads = omp_get_num_threads();
+
+#pragma omp single
+        threadTileCounts.assign(static_cast<size_t>(numThreads) * numTiles, 0);
+
+        int circleBegin = static_cast<long>(numberOfCircles) * thread / numThreads;
+        int circleEnd = static_cast<long>(numberOfCircles) * (thread + 1) / numThreads;
+        int *counts = &threadTileCounts[static_cast<size_t>(thread) * numTiles];
+
+        for (int circleIndex = circleBegin; circleIndex < circleEnd; circleIndex++)
+            forEachTile(circleIndex, [&](int tile) { counts[tile]++; });
+
+#pragma omp barrier
+#pragma omp single
+        {
+            int offset = 0;
+            for (int tile = 0; tile < numTiles; tile++) {
+                tileOffsets[tile] = offset;
+                for (int t = 0; t < numThreads; t++) {
+                    int &count = threadTileCounts[static_cast<size_t>(t) * numTiles + tile];
+                    int tileCount = count;
+                    count = offset;
+                    offset += tileCount;
+                }
+            }
+            tileOffsets[numTiles] = offset;
+            tileCircles.resize(offset);
+        }
+
+        for (int circleIndex = circleBegin; circleIndex < circleEnd; circleIndex++)
+            forEachTile(circleIndex, [&](int tile) { tileCircles[counts[tile]++] = circleIndex; });
+    }
+}
+
+void CpuParRenderer::render() {
+
+    binCircles();
+
+    // tiles differ wildly in how many circles they hold, so they are
+    // handed out one at a time
+#pragma omp parallel for schedule(dynamic)
+    for (int tile = 0; tile < tilesX * tilesY; tile++) {
+        int tileL = (tile % tilesX) * TILE_WIDTH;
+        int tileB = (tile / tilesX) * TILE_WIDTH;
+        int tileR = std::min(tileL + TILE_WIDTH, image->width);
+        int tileT = std::min(tileB + TILE_WIDTH, image->height);
+
+        for (int i = tileOffsets[tile]; i < tileOffsets[tile + 1]; i++)
+            renderCircle(tileCircles[i], tileL, tileR, tileB, tileT);
+    }
+}
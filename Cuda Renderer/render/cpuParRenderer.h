@@ -0,0 +1,42 @@
+#ifndef __CPU_PAR_RENDERER_H__
+#define __CPU_PAR_RENDERER_H__
+
+#include <vector>
+
+#include "refRenderer.h"
+
+// tile edge in pixels, matches BOX_WIDTH of the CUDA renderer
+#define TILE_WIDTH 32
+
+// Renders with every CPU thread.  Circles are binned to the screen tiles
+// they touch, in circle order, and each tile is then rendered by a
+// single thread, so every pixel still sees its circles blended in the
+// order of the reference renderer.  Scenes and animation are shared
+// with RefRenderer.
+class CpuParRenderer : public RefRenderer {
+
+private:
+    int tilesX;
+    int tilesY;
+
+    // circles of tile t are tileCircles[tileOffsets[t] .. tileOffsets[t + 1])
+    std::vector<int> tileOffsets;
+    std::vector<int> tileCircles;
+
+    // per thread counts of the circles each tile gets, and later where
+    // the thread writes its next circle of each tile
+    std::vector<int> threadTileCounts;
+
+    template <typename F>
+    void forEachTile(int circleIndex, F f);
+
+    void binCircles();
+
+public:
+    CpuParRenderer();
+    virtual ~CpuParRenderer();
+
+    void render();
+};
+
+#endif
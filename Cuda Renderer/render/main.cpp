@@ -3,6 +3,8 @@
 #include <stdlib.h>
 #include <string>
 
+#include "cpuDispatch.h"
+#include "cpuParRenderer.h"
 #include "cudaRenderer.h"
 #include "platformgl.h"
 #include "refRenderer.h"
@@ -17,10 +19,11 @@ void usage(const char *progname) {
     printf("Valid scenenames are: rgb, rgby, rand10k, rand100k, biglittle, littlebig, pattern, bouncingballs, fireworks, hypnosis, snow, snowsingle\n");
     printf("Program Options:\n");
     printf("  -b  --bench <START:END>    Benchmark mode, do not create display. Time frames [START,END)\n");
-    printf("  -c  --check                Check correctness of output\n");
+    printf("  -c  --check                Check correctness of output against ref\n");
     printf("  -f  --file  <FILENAME>     Dump frames in benchmark mode (FILENAME_xxxx.ppm)\n");
-    printf("  -r  --renderer <ref/cuda>  Select renderer: ref or cuda\n");
+    printf("  -r  --renderer <NAME>      Select renderer: ref, cuda or cpu-par (tiled, all CPU threads)\n");
     printf("  -s  --size  <INT>          Make rendered image <INT>x<INT> pixels\n");
+    printf("  -x  --isa   <NAME>         CPU kernels: default, sse4.2, avx2 or avx512 (detected when omitted)\n");
     printf("  -?  --help                 This message\n");
 }
 
@@ -34,6 +37,7 @@ int main(int argc, char **argv) {
     std::string frameFilename;
     SceneName sceneName;
     bool useRefRenderer = true;
+    bool useCpuParRenderer = false;
 
     bool checkCorrectness = false;
 
@@ -46,9 +50,10 @@ int main(int argc, char **argv) {
         {"file", 1, 0, 'f'},
         {"renderer", 1, 0, 'r'},
         {"size", 1, 0, 's'},
+        {"isa", 1, 0, 'x'},
         {0, 0, 0, 0}};
 
-    while ((opt = getopt_long(argc, argv, "b:f:r:s:c?", long_options, NULL)) != EOF) {
+    while ((opt = getopt_long(argc, argv, "b:f:r:s:x:c?", long_options, NULL)) != EOF) {
 
         switch (opt) {
         case 'b':
@@ -67,11 +72,21 @@ int main(int argc, char **argv) {
         case 'r':
             if (std::string(optarg).compare("cuda") == 0) {
                 useRefRenderer = false;
+            } else if (std::string(optarg).compare("cpu-par") == 0) {
+                useRefRenderer = false;
+                useCpuParRenderer = true;
             }
             break;
         case 's':
             imageSize = atoi(optarg);
             break;
+        case 'x':
+            if (!selectCpuIsa(optarg)) {
+                fprintf(stderr, "Instruction set %s is unknown or unsupported by this CPU\n", optarg);
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
         case '?':
         default:
             usage(argv[0]);
@@ -118,7 +133,7 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    printf("Rendering to %dx%d image\n", imageSize, imageSize);
+    printf("Rendering to %dx%d image, CPU kernels: %s\n", imageSize, imageSize, cpuIsaName(activeCpuIsa()));
 
     CircleRenderer *renderer;
 
@@ -129,7 +144,10 @@ int main(int argc, char **argv) {
         CircleRenderer *cuda_renderer;
 
         ref_renderer = new RefRenderer();
-        cuda_renderer = new CudaRenderer();
+        if (useCpuParRenderer)
+            cuda_renderer = new CpuParRenderer();
+        else
+            cuda_renderer = new CudaRenderer();
 
         ref_renderer->allocOutputImage(imageSize, imageSize);
         ref_renderer->loadScene(sceneName);
@@ -144,6 +162,8 @@ int main(int argc, char **argv) {
 
         if (useRefRenderer)
             renderer = new RefRenderer();
+        else if (useCpuParRenderer)
+            renderer = new CpuParRenderer();
         else
             renderer = new CudaRenderer();
 
@@ -1,9 +1,11 @@
 #include <algorithm>
+#include <immintrin.h>
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <stdio.h>
 #include <vector>
 
+#include "cpuDispatch.h"
 #include "image.h"
 #include "noise.h"
 #include "refRenderer.h"
@@ -274,16 +276,17 @@ lookupColor(float coord, float &r, float &g, float &b) {
 // given pixel.  All values are provided in normalized space, where
 // the screen spans [0,2]^2.  The color/opacity of the circle is
 // computed at the pixel center.
-void RefRenderer::shadePixel(
+static inline void
+shadeCirclePixel(
+    SceneName sceneName,
     float pixelCenterX, float pixelCenterY,
-    float px, float py, float pz,
-    float *pixelData,
-    int circleIndex) {
+    float px, float py, float pz, float rad,
+    const float *circleColor,
+    float *pixelData) {
     float diffX = px - pixelCenterX;
     float diffY = py - pixelCenterY;
     float pixelDist = diffX * diffX + diffY * diffY;
 
-    float rad = radius[circleIndex];
     float maxDist = rad * rad;
 
     // circle does not contribute to the image
@@ -313,10 +316,9 @@ void RefRenderer::shadePixel(
     } else {
 
         // simple: each circle has an assigned color
-        int index3 = 3 * circleIndex;
-        colR = color[index3];
-        colG = color[index3 + 1];
-        colB = color[index3 + 2];
+        colR = circleColor[0];
+        colG = circleColor[1];
+        colB = circleColor[2];
         alpha = .5f;
     }
 
@@ -340,62 +342,397 @@ void RefRenderer::shadePixel(
     pixelData[3] += alpha;
 }
 
-void RefRenderer::render() {
+void RefRenderer::shadePixel(
+    float pixelCenterX, float pixelCenterY,
+    float px, float py, float pz,
+    float *pixelData,
+    int circleIndex) {
+    shadeCirclePixel(sceneName, pixelCenterX, pixelCenterY, px, py, pz,
+                     radius[circleIndex], &color[3 * circleIndex], pixelData);
+}
 
-    // render all circles
-    for (int circleIndex = 0; circleIndex < numberOfCircles; circleIndex++) {
-
-        int index3 = 3 * circleIndex;
-
-        float px = position[index3];
-        float py = position[index3 + 1];
-        float pz = position[index3 + 2];
-        float rad = radius[circleIndex];
-
-        // compute the bounding box of the circle.  This bounding box
-        // is in normalized coordinates
-        float minX = px - rad;
-        float maxX = px + rad;
-        float minY = py - rad;
-        float maxY = py + rad;
-
-        // convert normalized coordinate bounds to integer screen
-        // pixel bounds.  Clamp to the edges of the screen.
-        int screenMinX = CLAMP(static_cast<int>(minX * image->width), 0, image->width);
-        int screenMaxX = CLAMP(static_cast<int>(maxX * image->width) + 1, 0, image->width);
-        int screenMinY = CLAMP(static_cast<int>(minY * image->height), 0, image->height);
-        int screenMaxY = CLAMP(static_cast<int>(maxY * image->height) + 1, 0, image->height);
-
-        float invWidth = 1.f / image->width;
-        float invHeight = 1.f / image->height;
-
-        // for each pixel in the bounding box, determine the circle's
-        // contribution to the pixel.  The contribution is computed in
-        // the function shadePixel.  Since the circle does not fill
-        // the bounding box entirely, not every pixel in the box will
-        // receive contribution.
-        for (int pixelY = screenMinY; pixelY < screenMaxY; pixelY++) {
-
-            // pointer to pixel data
-            float *imgPtr = &image->data[4 * (pixelY * image->width + screenMinX)];
-
-            for (int pixelX = screenMinX; pixelX < screenMaxX; pixelX++) {
-
-                // When "shading" the pixel ("shading" = computing the
-                // circle's color and opacity at the pixel), we treat
-                // the pixel as a point at the center of the pixel.
-                // We'll compute the color of the circle at this
-                // point.  Note that shading math will occur in the
-                // normalized [0,1]^2 coordinate space, so we convert
-                // the pixel center into this coordinate space prior
-                // to calling shadePixel.
-                float pixelCenterNormX = invWidth * (static_cast<float>(pixelX) + 0.5f);
-                float pixelCenterNormY = invHeight * (static_cast<float>(pixelY) + 0.5f);
-                shadePixel(pixelCenterNormX, pixelCenterNormY, px, py, pz, imgPtr, circleIndex);
-                imgPtr += 4;
+// shadeRow --
+//
+// Shades the pixels [minX, maxX) of one row of a circle's bounding
+// box, left to right.  The row is shaded by a variant built for each
+// instruction set; shadeRow calls the one picked at startup (see
+// cpuDispatch.h).  The plain and SSE4.2 variants are this loop, left
+// to the compiler to vectorize.
+static inline void
+shadeRowBody(
+    SceneName sceneName, float invWidth, float pixelCenterY,
+    int minX, int maxX,
+    float px, float py, float pz, float rad,
+    const float *circleColor,
+    float *imgPtr) {
+    for (int pixelX = minX; pixelX < maxX; pixelX++) {
+        float pixelCenterX = invWidth * (static_cast<float>(pixelX) + 0.5f);
+        shadeCirclePixel(sceneName, pixelCenterX, pixelCenterY, px, py, pz, rad, circleColor, imgPtr);
+        imgPtr += 4;
+    }
+}
+
+CPU_TARGET_SSE42 static void
+shadeRowSse42(
+    SceneName sceneName, float invWidth, float pixelCenterY,
+    int minX, int maxX,
+    float px, float py, float pz, float rad,
+    const float *circleColor,
+    float *imgPtr) {
+    shadeRowBody(sceneName, invWidth, pixelCenterY, minX, maxX,
+                 px, py, pz, rad, circleColor, imgPtr);
+}
+
+// The AVX2 and AVX-512 variants shade 8 or 16 adjacent pixels at once.
+// The image keeps pixels as interleaved RGBA, so a group of pixels is
+// transposed within each 128-bit lane into one register per channel,
+// blended, and transposed back.  Channel registers therefore hold the
+// pixels of a group in an interleaved order, given by the lane offsets
+// each variant starts from.
+//
+// Pixels outside the circle blend with zero alpha, which leaves them
+// unchanged, and the blend repeats the multiplies and adds of
+// shadeCirclePixel in its order.  Only the snowflake falloff differs
+// from the reference: it uses a polynomial exp, accurate to a few ulp.
+
+// colors of lookupColor's table, one row per channel, padded with the
+// last entry for the lookup one past the end
+static const float kSnowflakeColors[3][16] = {
+    {1.f, 1.f, .8f, .8f, .8f, .8f, .8f, .8f, .8f, .8f, .8f, .8f, .8f, .8f, .8f, .8f},
+    {1.f, 1.f, .9f, .9f, .8f, .8f, .8f, .8f, .8f, .8f, .8f, .8f, .8f, .8f, .8f, .8f},
+    {1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f},
+};
+
+// exp(x) as 2^n * e^r, with n the nearest integer to x / ln(2) and e^r
+// from a degree 6 polynomial on |r| <= ln(2) / 2
+static const float kExpPolynomial[6] = {
+    1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f,
+    4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f};
+
+CPU_TARGET_AVX2 static inline __m256
+expAvx2(__m256 x) {
+    x = _mm256_max_ps(x, _mm256_set1_ps(-87.f));
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504089f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(0.693359375f)));
+    r = _mm256_sub_ps(r, _mm256_mul_ps(n, _mm256_set1_ps(-2.12194440e-4f)));
+
+    __m256 p = _mm256_set1_ps(kExpPolynomial[0]);
+    for (int i = 1; i < 6; i++)
+        p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(kExpPolynomial[i]));
+    __m256 expR = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(p, r), r), r), _mm256_set1_ps(1.f));
+
+    __m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(expR, _mm256_castsi256_ps(pow2n));
+}
+
+// Turns four registers of interleaved RGBA pixels into one register
+// per channel, or back, within each 128-bit lane
+#define TRANSPOSE_RGBA(unpacklo, unpackhi, shuffle, v0, v1, v2, v3) \
+    do {                                                             \
+        auto t0 = unpacklo(v0, v1);                                  \
+        auto t1 = unpackhi(v0, v1);                                  \
+        auto t2 = unpacklo(v2, v3);                                  \
+        auto t3 = unpackhi(v2, v3);                                  \
+        v0 = shuffle(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));               \
+        v1 = shuffle(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));               \
+        v2 = shuffle(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));               \
+        v3 = shuffle(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));               \
+    } while (0)
+
+CPU_TARGET_AVX2 static void
+shadeRowAvx2(
+    SceneName sceneName, float invWidth, float pixelCenterY,
+    int minX, int maxX,
+    float px, float py, float pz, float rad,
+    const float *circleColor,
+    float *imgPtr) {
+
+    // pixel of the group in each lane of a channel register
+    const __m256i laneOffsets = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    const __m256 one = _mm256_set1_ps(1.f);
+
+    bool snowflakes = sceneName == SNOWFLAKES || sceneName == SNOWFLAKES_SINGLE_FRAME;
+    float diffY = py - pixelCenterY;
+    __m256 diffYSquared = _mm256_set1_ps(diffY * diffY);
+    __m256 maxDist = _mm256_set1_ps(rad * rad);
+    float maxAlpha = .5f * CLAMP(.6f + .4f * (1.f - pz), 0.f, 1.f);
+
+    int pixelX = minX;
+    for (; pixelX + 8 <= maxX; pixelX += 8, imgPtr += 32) {
+        __m256 pixelXs = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(pixelX), laneOffsets));
+        __m256 pixelCenterX = _mm256_mul_ps(_mm256_set1_ps(invWidth), _mm256_add_ps(pixelXs, _mm256_set1_ps(0.5f)));
+        __m256 diffX = _mm256_sub_ps(_mm256_set1_ps(px), pixelCenterX);
+        __m256 pixelDist = _mm256_add_ps(_mm256_mul_ps(diffX, diffX), diffYSquared);
+        __m256 inside = _mm256_cmp_ps(pixelDist, maxDist, _CMP_LE_OQ);
+        if (_mm256_testz_ps(inside, inside))
+            continue;
+
+        __m256 alpha, colR, colG, colB;
+        if (snowflakes) {
+            __m256 normPixelDist = _mm256_div_ps(_mm256_sqrt_ps(pixelDist), _mm256_set1_ps(rad));
+            __m256 scaledCoord = _mm256_mul_ps(normPixelDist, _mm256_set1_ps(4.f));
+            __m256i base = _mm256_min_epi32(_mm256_cvttps_epi32(scaledCoord), _mm256_set1_epi32(4));
+            __m256i next = _mm256_add_epi32(base, _mm256_set1_epi32(1));
+            __m256 weight = _mm256_sub_ps(scaledCoord, _mm256_cvtepi32_ps(base));
+            __m256 oneMinusWeight = _mm256_sub_ps(one, weight);
+            __m256 *cols[3] = {&colR, &colG, &colB};
+            for (int c = 0; c < 3; c++) {
+                __m256 table = _mm256_loadu_ps(kSnowflakeColors[c]);
+                *cols[c] = _mm256_add_ps(_mm256_mul_ps(oneMinusWeight, _mm256_permutevar8x32_ps(table, base)),
+                                         _mm256_mul_ps(weight, _mm256_permutevar8x32_ps(table, next)));
             }
+            __m256 falloff = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(-1.f * 4.f), normPixelDist), normPixelDist);
+            alpha = _mm256_mul_ps(_mm256_set1_ps(maxAlpha), expAvx2(falloff));
+        } else {
+            colR = _mm256_set1_ps(circleColor[0]);
+            colG = _mm256_set1_ps(circleColor[1]);
+            colB = _mm256_set1_ps(circleColor[2]);
+            alpha = _mm256_set1_ps(.5f);
         }
+        alpha = _mm256_and_ps(alpha, inside);
+        __m256 oneMinusAlpha = _mm256_sub_ps(one, alpha);
+
+        __m256 r = _mm256_loadu_ps(imgPtr);
+        __m256 g = _mm256_loadu_ps(imgPtr + 8);
+        __m256 b = _mm256_loadu_ps(imgPtr + 16);
+        __m256 a = _mm256_loadu_ps(imgPtr + 24);
+        TRANSPOSE_RGBA(_mm256_unpacklo_ps, _mm256_unpackhi_ps, _mm256_shuffle_ps, r, g, b, a);
+        r = _mm256_add_ps(_mm256_mul_ps(alpha, colR), _mm256_mul_ps(oneMinusAlpha, r));
+        g = _mm256_add_ps(_mm256_mul_ps(alpha, colG), _mm256_mul_ps(oneMinusAlpha, g));
+        b = _mm256_add_ps(_mm256_mul_ps(alpha, colB), _mm256_mul_ps(oneMinusAlpha, b));
+        a = _mm256_add_ps(a, alpha);
+        TRANSPOSE_RGBA(_mm256_unpacklo_ps, _mm256_unpackhi_ps, _mm256_shuffle_ps, r, g, b, a);
+        _mm256_storeu_ps(imgPtr, r);
+        _mm256_storeu_ps(imgPtr + 8, g);
+        _mm256_storeu_ps(imgPtr + 16, b);
+        _mm256_storeu_ps(imgPtr + 24, a);
     }
+
+    shadeRowBody(sceneName, invWidth, pixelCenterY, pixelX, maxX,
+                 px, py, pz, rad, circleColor, imgPtr);
+}
+
+// GCC 12 takes the undefined pass-through operand of many AVX-512
+// intrinsics for an uninitialized variable
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+CPU_TARGET_AVX512 static inline __m512
+expAvx512(__m512 x) {
+    x = _mm512_max_ps(x, _mm512_set1_ps(-87.f));
+    __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(1.44269504089f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_sub_ps(x, _mm512_mul_ps(n, _mm512_set1_ps(0.693359375f)));
+    r = _mm512_sub_ps(r, _mm512_mul_ps(n, _mm512_set1_ps(-2.12194440e-4f)));
+
+    __m512 p = _mm512_set1_ps(kExpPolynomial[0]);
+    for (int i = 1; i < 6; i++)
+        p = _mm512_add_ps(_mm512_mul_ps(p, r), _mm512_set1_ps(kExpPolynomial[i]));
+    __m512 expR = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(_mm512_mul_ps(p, r), r), r), _mm512_set1_ps(1.f));
+
+    __m512i pow2n = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23);
+    return _mm512_mul_ps(expR, _mm512_castsi512_ps(pow2n));
+}
+
+// Same as shadeRowAvx2 on 16 pixels, with the last partial group of the
+// row shaded under a mask rather than one pixel at a time
+CPU_TARGET_AVX512 static void
+shadeRowAvx512(
+    SceneName sceneName, float invWidth, float pixelCenterY,
+    int minX, int maxX,
+    float px, float py, float pz, float rad,
+    const float *circleColor,
+    float *imgPtr) {
+
+    // pixel of the group in each lane of a channel register
+    const __m512i laneOffsets = _mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    const __m512 one = _mm512_set1_ps(1.f);
+
+    bool snowflakes = sceneName == SNOWFLAKES || sceneName == SNOWFLAKES_SINGLE_FRAME;
+    float diffY = py - pixelCenterY;
+    __m512 diffYSquared = _mm512_set1_ps(diffY * diffY);
+    __m512 maxDist = _mm512_set1_ps(rad * rad);
+    float maxAlpha = .5f * CLAMP(.6f + .4f * (1.f - pz), 0.f, 1.f);
+
+    for (int pixelX = minX; pixelX < maxX; pixelX += 16, imgPtr += 64) {
+        int numPixels = std::min(maxX - pixelX, 16);
+        __mmask16 valid = _mm512_cmplt_epi32_mask(laneOffsets, _mm512_set1_epi32(numPixels));
+
+        __m512 pixelXs = _mm512_cvtepi32_ps(_mm512_add_epi32(_mm512_set1_epi32(pixelX), laneOffsets));
+        __m512 pixelCenterX = _mm512_mul_ps(_mm512_set1_ps(invWidth), _mm512_add_ps(pixelXs, _mm512_set1_ps(0.5f)));
+        __m512 diffX = _mm512_sub_ps(_mm512_set1_ps(px), pixelCenterX);
+        __m512 pixelDist = _mm512_add_ps(_mm512_mul_ps(diffX, diffX), diffYSquared);
+        __mmask16 inside = _mm512_mask_cmp_ps_mask(valid, pixelDist, maxDist, _CMP_LE_OQ);
+        if (!inside)
+            continue;
+
+        __m512 alpha, colR, colG, colB;
+        if (snowflakes) {
+            __m512 normPixelDist = _mm512_div_ps(_mm512_sqrt_ps(pixelDist), _mm512_set1_ps(rad));
+            __m512 scaledCoord = _mm512_mul_ps(normPixelDist, _mm512_set1_ps(4.f));
+            __m512i base = _mm512_min_epi32(_mm512_cvttps_epi32(scaledCoord), _mm512_set1_epi32(4));
+            __m512i next = _mm512_add_epi32(base, _mm512_set1_epi32(1));
+            __m512 weight = _mm512_sub_ps(scaledCoord, _mm512_cvtepi32_ps(base));
+            __m512 oneMinusWeight = _mm512_sub_ps(one, weight);
+            __m512 *cols[3] = {&colR, &colG, &colB};
+            for (int c = 0; c < 3; c++) {
+                __m512 table = _mm512_loadu_ps(kSnowflakeColors[c]);
+                *cols[c] = _mm512_add_ps(_mm512_mul_ps(oneMinusWeight, _mm512_permutexvar_ps(base, table)),
+                                         _mm512_mul_ps(weight, _mm512_permutexvar_ps(next, table)));
+            }
+            __m512 falloff = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(-1.f * 4.f), normPixelDist), normPixelDist);
+            alpha = _mm512_mul_ps(_mm512_set1_ps(maxAlpha), expAvx512(falloff));
+        } else {
+            colR = _mm512_set1_ps(circleColor[0]);
+            colG = _mm512_set1_ps(circleColor[1]);
+            colB = _mm512_set1_ps(circleColor[2]);
+            alpha = _mm512_set1_ps(.5f);
+        }
+        alpha = _mm512_maskz_mov_ps(inside, alpha);
+        __m512 oneMinusAlpha = _mm512_sub_ps(one, alpha);
+
+        // register k holds the channels of pixels 4k .. 4k + 3
+        __mmask16 masks[4];
+        for (int k = 0; k < 4; k++) {
+            int count = CLAMP(numPixels - 4 * k, 0, 4);
+            masks[k] = count == 4 ? 0xFFFF : (1u << (4 * count)) - 1;
+        }
+        __m512 r = _mm512_maskz_loadu_ps(masks[0], imgPtr);
+        __m512 g = _mm512_maskz_loadu_ps(masks[1], imgPtr + 16);
+        __m512 b = _mm512_maskz_loadu_ps(masks[2], imgPtr + 32);
+        __m512 a = _mm512_maskz_loadu_ps(masks[3], imgPtr + 48);
+        TRANSPOSE_RGBA(_mm512_unpacklo_ps, _mm512_unpackhi_ps, _mm512_shuffle_ps, r, g, b, a);
+        r = _mm512_add_ps(_mm512_mul_ps(alpha, colR), _mm512_mul_ps(oneMinusAlpha, r));
+        g = _mm512_add_ps(_mm512_mul_ps(alpha, colG), _mm512_mul_ps(oneMinusAlpha, g));
+        b = _mm512_add_ps(_mm512_mul_ps(alpha, colB), _mm512_mul_ps(oneMinusAlpha, b));
+        a = _mm512_add_ps(a, alpha);
+        TRANSPOSE_RGBA(_mm512_unpacklo_ps, _mm512_unpackhi_ps, _mm512_shuffle_ps, r, g, b, a);
+        _mm512_mask_storeu_ps(imgPtr, masks[0], r);
+        _mm512_mask_storeu_ps(imgPtr + 16, masks[1], g);
+        _mm512_mask_storeu_ps(imgPtr + 32, masks[2], b);
+        _mm512_mask_storeu_ps(imgPtr + 48, masks[3], a);
+    }
+}
+
+#pragma GCC diagnostic pop
+
+#undef TRANSPOSE_RGBA
+
+static void
+shadeRow(
+    SceneName sceneName, float invWidth, float pixelCenterY,
+    int minX, int maxX,
+    float px, float py, float pz, float rad,
+    const float *circleColor,
+    float *imgPtr) {
+    switch (activeCpuIsa()) {
+    case CPU_ISA_AVX512:
+        shadeRowAvx512(sceneName, invWidth, pixelCenterY, minX, maxX, px, py, pz, rad, circleColor, imgPtr);
+        break;
+    case CPU_ISA_AVX2:
+        shadeRowAvx2(sceneName, invWidth, pixelCenterY, minX, maxX, px, py, pz, rad, circleColor, imgPtr);
+        break;
+    case CPU_ISA_SSE42:
+        shadeRowSse42(sceneName, invWidth, pixelCenterY, minX, maxX, px, py, pz, rad, circleColor, imgPtr);
+        break;
+    default:
+        shadeRowBody(sceneName, invWidth, pixelCenterY, minX, maxX, px, py, pz, rad, circleColor, imgPtr);
+        break;
+    }
+}
+
+// circleScreenBox --
+//
+// Computes the integer screen pixel bounds [minX, maxX) x [minY, maxY)
+// of a circle's bounding box, clamped to the edges of the screen.
+// Returns false when the box is empty.
+bool RefRenderer::circleScreenBox(
+    int circleIndex,
+    int &screenMinX, int &screenMaxX,
+    int &screenMinY, int &screenMaxY) {
+
+    int index3 = 3 * circleIndex;
+
+    float px = position[index3];
+    float py = position[index3 + 1];
+    float rad = radius[circleIndex];
+
+    // compute the bounding box of the circle.  This bounding box
+    // is in normalized coordinates
+    float minX = px - rad;
+    float maxX = px + rad;
+    float minY = py - rad;
+    float maxY = py + rad;
+
+    // convert normalized coordinate bounds to integer screen
+    // pixel bounds.  Clamp to the edges of the screen.
+    screenMinX = CLAMP(static_cast<int>(minX * image->width), 0, image->width);
+    screenMaxX = CLAMP(static_cast<int>(maxX * image->width) + 1, 0, image->width);
+    screenMinY = CLAMP(static_cast<int>(minY * image->height), 0, image->height);
+    screenMaxY = CLAMP(static_cast<int>(maxY * image->height) + 1, 0, image->height);
+
+    return screenMinX < screenMaxX && screenMinY < screenMaxY;
+}
+
+// renderCircle --
+//
+// Blends one circle into the pixels of its bounding box that also lie
+// in the box [boxMinX, boxMaxX) x [boxMinY, boxMaxY) of the screen.
+void RefRenderer::renderCircle(
+    int circleIndex,
+    int boxMinX, int boxMaxX,
+    int boxMinY, int boxMaxY) {
+
+    int screenMinX, screenMaxX, screenMinY, screenMaxY;
+    if (!circleScreenBox(circleIndex, screenMinX, screenMaxX, screenMinY, screenMaxY))
+        return;
+
+    screenMinX = std::max(screenMinX, boxMinX);
+    screenMaxX = std::min(screenMaxX, boxMaxX);
+    screenMinY = std::max(screenMinY, boxMinY);
+    screenMaxY = std::min(screenMaxY, boxMaxY);
+    if (screenMinX >= screenMaxX)
+        return;
+
+    int index3 = 3 * circleIndex;
+
+    float px = position[index3];
+    float py = position[index3 + 1];
+    float pz = position[index3 + 2];
+    float rad = radius[circleIndex];
+
+    float invWidth = 1.f / image->width;
+    float invHeight = 1.f / image->height;
+
+    // for each pixel in the bounding box, determine the circle's
+    // contribution to the pixel.  The contribution is computed in
+    // the function shadePixel.  Since the circle does not fill
+    // the bounding box entirely, not every pixel in the box will
+    // receive contribution.
+    for (int pixelY = screenMinY; pixelY < screenMaxY; pixelY++) {
+
+        // pointer to pixel data
+        float *imgPtr = &image->data[4 * (pixelY * image->width + screenMinX)];
+
+        // When "shading" the pixel ("shading" = computing the
+        // circle's color and opacity at the pixel), we treat
+        // the pixel as a point at the center of the pixel.
+        // We'll compute the color of the circle at this
+        // point.  Note that shading math will occur in the
+        // normalized [0,1]^2 coordinate space, so we convert
+        // the pixel center into this coordinate space prior
+        // to shading the row.
+        float pixelCenterNormY = invHeight * (static_cast<float>(pixelY) + 0.5f);
+        shadeRow(sceneName, invWidth, pixelCenterNormY, screenMinX, screenMaxX,
+                 px, py, pz, rad, &color[index3], imgPtr);
+    }
+}
+
+void RefRenderer::render() {
+
+    // render all circles
+    for (int circleIndex = 0; circleIndex < numberOfCircles; circleIndex++)
+        renderCircle(circleIndex, 0, image->width, 0, image->height);
 }
 
 void RefRenderer::dumpParticles(const char *filename) {
@@ -5,7 +5,7 @@
 
 class RefRenderer : public CircleRenderer {
 
-private:
+protected:
     Image *image;
     SceneName sceneName;
 
@@ -15,6 +15,16 @@ private:
     float *color;
     float *radius;
 
+    bool circleScreenBox(
+        int circleIndex,
+        int &screenMinX, int &screenMaxX,
+        int &screenMinY, int &screenMaxY);
+
+    void renderCircle(
+        int circleIndex,
+        int boxMinX, int boxMaxX,
+        int boxMinY, int boxMaxY);
+
 public:
     RefRenderer();
     virtual ~RefRenderer();
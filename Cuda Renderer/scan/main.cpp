@@ -1,10 +1,13 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 #include <getopt.h>
 #include <string>
 #include <cstring>
+#include <immintrin.h>
 
 #include "CycleTimer.h"
+#include "../render/cpuDispatch.h"
 
 double cudaFindPeaks(int *input, int length, int *output, int *output_length); 
 double cudaScan(int* start, int* end, int* resultarray);
@@ -20,9 +23,92 @@ void usage(const char* progname) {
     printf("  -i  --input <NAME>     Run test on given input type. Valid inputs  are: test1, random\n");
     printf("  -n  --arraysize <INT>  Number of elements in arrays\n");
     printf("  -t  --thrust           Use Thrust library implementation\n");
+    printf("  -x  --isa <NAME>       CPU scan instruction set: default, sse4.2, avx2, avx512\n");
     printf("  -?  --help             This message\n");
 }
 
+// SIMD exclusive scans: each block gets an in-register inclusive prefix
+// sum (log-step shift and add), the block's own inputs are subtracted to
+// make it exclusive, and the running total is carried into the next block.
+CPU_TARGET_SSE42 static void cpu_exclusive_scan_sse42(int* start, int* end, int* output)
+{
+    int N = end - start;
+    __m128i carry = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 4 <= N; i += 4)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(start + i));
+        __m128i sum = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        sum = _mm_add_epi32(sum, _mm_slli_si128(sum, 8));
+        sum = _mm_add_epi32(sum, carry);
+        _mm_storeu_si128((__m128i*)(output + i), _mm_sub_epi32(sum, x));
+        carry = _mm_shuffle_epi32(sum, 0xFF);
+    }
+    int total = _mm_cvtsi128_si32(carry);
+    for (; i < N; i++)
+    {
+        output[i] = total;
+        total += start[i];
+    }
+}
+
+CPU_TARGET_AVX2 static void cpu_exclusive_scan_avx2(int* start, int* end, int* output)
+{
+    int N = end - start;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lane3 = _mm256_set1_epi32(3);
+    const __m256i lane7 = _mm256_set1_epi32(7);
+    __m256i carry = zero;
+    int i = 0;
+    for (; i + 8 <= N; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(start + i));
+        // byte shifts stay within each 128-bit half, so the low half's
+        // total is then added to every lane of the high half
+        __m256i sum = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+        sum = _mm256_add_epi32(sum, _mm256_slli_si256(sum, 8));
+        __m256i low = _mm256_permutevar8x32_epi32(sum, lane3);
+        sum = _mm256_add_epi32(sum, _mm256_blend_epi32(zero, low, 0xF0));
+        sum = _mm256_add_epi32(sum, carry);
+        _mm256_storeu_si256((__m256i*)(output + i), _mm256_sub_epi32(sum, x));
+        carry = _mm256_permutevar8x32_epi32(sum, lane7);
+    }
+    int total = _mm256_cvtsi256_si32(carry);
+    for (; i < N; i++)
+    {
+        output[i] = total;
+        total += start[i];
+    }
+}
+
+CPU_TARGET_AVX512 static void cpu_exclusive_scan_avx512(int* start, int* end, int* output)
+{
+    int N = end - start;
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i lane15 = _mm512_set1_epi32(15);
+    __m512i carry = zero;
+    int i = 0;
+    // full-mask maskz forms sidestep the undefined passthrough operand of
+    // the plain intrinsics, which -Wall flags as uninitialized
+    for (; i + 16 <= N; i += 16)
+    {
+        __m512i x = _mm512_loadu_si512(start + i);
+        __m512i sum = _mm512_add_epi32(x, _mm512_maskz_alignr_epi32(0xFFFF, x, zero, 15));
+        sum = _mm512_add_epi32(sum, _mm512_maskz_alignr_epi32(0xFFFF, sum, zero, 14));
+        sum = _mm512_add_epi32(sum, _mm512_maskz_alignr_epi32(0xFFFF, sum, zero, 12));
+        sum = _mm512_add_epi32(sum, _mm512_maskz_alignr_epi32(0xFFFF, sum, zero, 8));
+        sum = _mm512_add_epi32(sum, carry);
+        _mm512_storeu_si512(output + i, _mm512_sub_epi32(sum, x));
+        carry = _mm512_maskz_permutexvar_epi32(0xFFFF, lane15, sum);
+    }
+    int total = _mm512_cvtsi512_si32(carry);
+    for (; i < N; i++)
+    {
+        output[i] = total;
+        total += start[i];
+    }
+}
+
 void cpu_exclusive_scan(int* start, int* end, int* output)
 {
 #ifdef PARALLEL
@@ -54,6 +140,19 @@ void cpu_exclusive_scan(int* start, int* end, int* output)
         }
     }
 #endif
+    switch (activeCpuIsa()) {
+    case CPU_ISA_AVX512:
+        cpu_exclusive_scan_avx512(start, end, output);
+        return;
+    case CPU_ISA_AVX2:
+        cpu_exclusive_scan_avx2(start, end, output);
+        return;
+    case CPU_ISA_SSE42:
+        cpu_exclusive_scan_sse42(start, end, output);
+        return;
+    default:
+        break;
+    }
     int N = end - start;
     output[0] = 0;
     for (int i = 1; i < N; i++)
@@ -91,10 +190,11 @@ int main(int argc, char** argv)
         {"input",      1, 0, 'i'},
         {"help",       0, 0, '?'},
         {"thrust",     0, 0, 't'},
+        {"isa",        1, 0, 'x'},
         {0 ,0, 0, 0}
     };
 
-    while ((opt = getopt_long(argc, argv, "m:n:i:?t", long_options, NULL)) != EOF) {
+    while ((opt = getopt_long(argc, argv, "m:n:i:x:?t", long_options, NULL)) != EOF) {
         switch (opt) {
         case 'm':
             test = optarg; 
@@ -108,6 +208,12 @@ int main(int argc, char** argv)
         case 't':
             useThrust = true;
             break;
+        case 'x':
+            if (!selectCpuIsa(optarg)) {
+                fprintf(stderr, "Instruction set %s is unknown or unsupported by this CPU.\n", optarg);
+                return 1;
+            }
+            break;
         case '?':
         default:
             usage(argv[0]);
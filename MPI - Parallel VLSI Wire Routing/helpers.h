@@ -0,0 +1,51 @@
+/**
+ * Parallel VLSI Wire Routing via MPI
+ *
+ * Route walks over the whole board and rank helpers; the walkers, candidates
+ * and annealing policy themselves live in the shared core
+ */
+
+#ifndef __HELPERS_H__
+#define __HELPERS_H__
+
+#include "wireroute.h"
+#include "mpi/mpi.h"
+
+#include <assert.h>
+#include <string>
+#include <vector>
+
+inline std::string proc_info() {
+    int procID;
+    MPI_Comm_rank(MPI_COMM_WORLD, &procID);
+    return "[" + std::to_string(procID) + "] ";
+}
+
+// Dispatches on cost_change once per route rather than once per cell
+inline Metrics walk_a_route(Data data, cost_t *costs, const Route &route, int cost_change) {
+    switch (cost_change) {
+    case 1:
+        return walk_route<WALK_ADD>(data.dim_x, costs, route);
+    case -1:
+        return walk_route<WALK_REMOVE>(data.dim_x, costs, route);
+    default:
+        assert(cost_change == 0);
+        return walk_route<WALK_SCORE>(data.dim_x, costs, route);
+    }
+}
+
+inline Metrics walk_a_route_atomic(Data data, cost_t *costs, const Route &route, int cost_change) {
+    if (cost_change == 1)
+        return walk_route<WALK_ATOMIC_ADD>(data.dim_x, costs, route);
+    assert(cost_change == -1);
+    return walk_route<WALK_ATOMIC_REMOVE>(data.dim_x, costs, route);
+}
+
+inline Metrics walk_all_routes(Data data, cost_t *costs, const Route *routes, int cost_change) {
+    Metrics metrics_of_all_routes;
+    for (int i = 0; i != data.num_of_wires; i++)
+        metrics_of_all_routes.update(walk_a_route(data, costs, routes[i], cost_change));
+    return metrics_of_all_routes;
+}
+
+#endif
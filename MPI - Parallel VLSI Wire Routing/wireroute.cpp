@@ -2,7 +2,9 @@
 // #include "mpi.h"
 #include "helpers.h"
 #include "mpi/mpi.h"
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -10,159 +12,1743 @@
 #include <fstream>
 #include <iostream>
 #include <libgen.h>
+#include <sstream>
+#include <omp.h>
+
+static int _argc;
+static const char **_argv;
+
+const char *get_option_string(const char *option_name,
+                              const char *default_value) {
+    for (int i = _argc - 2; i >= 0; i -= 2)
+        if (strcmp(_argv[i], option_name) == 0)
+            return _argv[i + 1];
+    return default_value;
+}
+
+int get_option_int(const char *option_name, int default_value) {
+    for (int i = _argc - 2; i >= 0; i -= 2)
+        if (strcmp(_argv[i], option_name) == 0)
+            return atoi(_argv[i + 1]);
+    return default_value;
+}
+
+float get_option_float(const char *option_name, float default_value) {
+    for (int i = _argc - 2; i >= 0; i -= 2)
+        if (strcmp(_argv[i], option_name) == 0)
+            return (float)atof(_argv[i + 1]);
+    return default_value;
+}
+
+static void show_help(const char *program_path) {
+    printf("Usage: %s OPTIONS\n", program_path);
+    printf("\n");
+    printf("OPTIONS:\n");
+    printf("\t-f <input_filename> (required; .bin netlists are read with collective MPI-IO)\n");
+    printf("\t-c <binary_filename> (convert the text netlist given with -f to the binary format and exit)\n");
+    printf("\t-p <SA_prob>\n");
+    printf("\t-i <SA_iters>\n");
+    printf("\t-b <sync_interval> (local wires between cost synchronizations, 0 for once per iteration)\n");
+    printf("\t-d <decomposed> (1 to split the board into blocks owned by ranks)\n");
+    printf("\t-w <halo_width> (cells of neighbor blocks kept by each rank when decomposed)\n");
+    printf("\t-o <overlap> (1 to exchange costs while the next batch is routed)\n");
+    printf("\t-g <shared_grids> (1 to share one cost grid between the ranks of a node)\n");
+    printf("\t-n <num_of_threads> (per rank; run one rank per node or socket, e.g. mpirun --map-by ppr:1:socket:pe=<n>)\n");
+    printf("\t-r <rma> (1 to read and update row bands owned by other ranks with one-sided MPI)\n");
+    printf("\t-l <dynamic> (1 to pull wire chunks from a shared counter, synchronizing once per iteration)\n");
+    printf("\t-O <objective> (max-sum, weighted or overflow)\n");
+    printf("\t-x <isa> (default, sse4.2, avx2 or avx512; detected from the CPU when omitted)\n");
+}
+
+int main(int argc, char *argv[]) {
+    // Only the main thread of a rank talks to MPI
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+
+    int procID, nproc;
+    MPI_Comm_rank(MPI_COMM_WORLD, &procID);
+    MPI_Comm_size(MPI_COMM_WORLD, &nproc);
+
+    _argc = argc - 1;
+    _argv = (const char **)argv + 1;
+
+    const char *input_filename = get_option_string("-f", NULL);
+    Options options;
+    options.SA_prob = get_option_float("-p", 0.1f);
+    options.SA_iters = get_option_int("-i", 5);
+    options.sync_interval = get_option_int("-b", 0);
+    options.decomposed = get_option_int("-d", 0) != 0;
+    options.halo_width = get_option_int("-w", 32);
+    options.overlap = get_option_int("-o", 0) != 0;
+    options.dynamic = get_option_int("-l", 0) != 0;
+    options.num_of_threads = get_option_int("-n", 1);
+    options.shared = get_option_int("-g", 0) != 0;
+    options.rma = get_option_int("-r", 0) != 0;
+    std::string objective_name = get_option_string("-O", "max-sum");
+    const char *isa_override = get_option_string("-x", NULL);
+
+    // Converting a text netlist to the binary format is all that happens with -c
+    const char *convert_filename = get_option_string("-c", NULL);
+    if (input_filename != NULL && convert_filename != NULL) {
+        int status = procID == 0 ? convert_netlist(input_filename, convert_filename) : 0;
+        MPI_Finalize();
+        return status;
+    }
+
+    if (input_filename == NULL) {
+        if (procID == 0) {
+            printf("Error: You need to specify -f.\n");
+            show_help(argv[0]);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    if (!parse_objective(objective_name, &options.objective)) {
+        if (procID == 0) {
+            printf("Error: Unknown objective %s.\n", objective_name.c_str());
+            show_help(argv[0]);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    Isa isa = active_isa();
+    if (isa_override && (!parse_isa(isa_override, &isa) || !isa_supported(isa))) {
+        if (procID == 0) {
+            printf("Error: Instruction set %s is unknown or unsupported by this CPU.\n", isa_override);
+            show_help(argv[0]);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    active_isa() = isa;
+
+    if (provided < MPI_THREAD_FUNNELED && options.num_of_threads > 1) {
+        if (procID == 0)
+            printf("Warning: MPI lacks thread support, running one thread per rank.\n");
+        options.num_of_threads = 1;
+    }
+    if (options.decomposed && (options.shared || options.overlap || options.dynamic || options.rma)) {
+        if (procID == 0)
+            printf("Warning: -g, -o, -l and -r do not apply to the decomposed mode.\n");
+        options.shared = options.overlap = options.dynamic = options.rma = false;
+    }
+    if (options.rma && (options.shared || options.dynamic)) {
+        if (procID == 0)
+            printf("Warning: -g and -l do not apply to the one-sided mode.\n");
+        options.shared = options.dynamic = false;
+    }
+    if (options.shared && options.overlap) {
+        if (procID == 0)
+            printf("Warning: -o does not apply to node-shared grids, synchronizing in place.\n");
+        options.overlap = false;
+    }
+    omp_set_num_threads(options.num_of_threads);
+    if (procID == 0)
+        printf("Ranks x Threads: \t\t\t[%d x %d], instruction set [%s].\n", nproc, options.num_of_threads, isa_name(active_isa()));
+
+    compute(procID, nproc, input_filename, options);
+    report_telemetry(procID, nproc);
+
+    MPI_Finalize();
+    return 0;
+}
+
+/* Telemetry: every rank accumulates the wall time of each phase, the traffic
+ * of its collectives and one-sided transfers, the time it is blocked in them,
+ * and the work it did. The root gathers the records once, at the end. */
+
+enum Phase { PHASE_LOAD, PHASE_BROADCAST, PHASE_ROUTE, PHASE_SYNC, PHASE_WRITE, NUM_PHASES };
+
+struct Telemetry {
+    double phase_time[NUM_PHASES];
+    double idle_time; // blocked in collectives, waits and flushes
+    long long bytes_sent, bytes_received;
+    long long wires, candidates;
+    long long route_allocations; // heap allocations while routing
+};
+
+static Telemetry telemetry;
+static Phase current_phase = PHASE_LOAD;
+static double phase_start;
+
+// Every operator new is counted, so the report shows whether the routing
+// loops allocate
+static std::atomic<long long> num_of_allocations(0);
+static long long phase_allocations;
+
+void *operator new(size_t size) {
+    ++num_of_allocations;
+    if (void *ptr = malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+// Charges the time since the last switch to the current phase and returns it
+static Phase enter_phase(Phase phase) {
+    double now = MPI_Wtime();
+    long long allocations = num_of_allocations;
+    telemetry.phase_time[current_phase] += now - phase_start;
+    if (current_phase == PHASE_ROUTE)
+        telemetry.route_allocations += allocations - phase_allocations;
+    Phase prev_phase = current_phase;
+    current_phase = phase;
+    phase_start = now;
+    phase_allocations = allocations;
+    return prev_phase;
+}
+
+// Runs a blocking transfer, counting its bytes and the time spent in it
+template <typename Transfer>
+static void track(long long bytes_sent, long long bytes_received, Transfer transfer) {
+    double start = MPI_Wtime();
+    transfer();
+    telemetry.idle_time += MPI_Wtime() - start;
+    telemetry.bytes_sent += bytes_sent;
+    telemetry.bytes_received += bytes_received;
+}
+
+void report_telemetry(int procID, int nproc) {
+    const int root = 0;
+    enter_phase(current_phase);
+    std::vector<Telemetry> all(procID == root ? nproc : 0);
+    MPI_Gather(&telemetry, sizeof(Telemetry), MPI_BYTE, all.data(), sizeof(Telemetry), MPI_BYTE, root, MPI_COMM_WORLD);
+    if (procID != root)
+        return;
+
+    const int num_of_columns = NUM_PHASES + 6;
+    const char *names[num_of_columns] = {"load", "bcast", "route", "sync", "write", "idle", "sent MB", "recv MB", "wires", "cands", "allocs"};
+    std::vector<double> table((size_t)nproc * num_of_columns);
+    for (int rank = 0; rank != nproc; ++rank) {
+        double *row = &table[(size_t)rank * num_of_columns];
+        const Telemetry &t = all[rank];
+        std::copy(t.phase_time, t.phase_time + NUM_PHASES, row);
+        row[NUM_PHASES] = t.idle_time;
+        row[NUM_PHASES + 1] = t.bytes_sent / 1e6;
+        row[NUM_PHASES + 2] = t.bytes_received / 1e6;
+        row[NUM_PHASES + 3] = t.wires;
+        row[NUM_PHASES + 4] = t.candidates;
+        row[NUM_PHASES + 5] = t.route_allocations;
+    }
+
+    printf("%-8s", "rank");
+    for (int c = 0; c != num_of_columns; ++c)
+        printf("%12s", names[c]);
+    printf("\n");
+    for (int rank = 0; rank != nproc; ++rank) {
+        printf("%-8d", rank);
+        for (int c = 0; c != num_of_columns; ++c)
+            printf("%12.4g", table[(size_t)rank * num_of_columns + c]);
+        printf("\n");
+    }
+
+    // min / avg / max over ranks, and max / avg as the imbalance
+    double stats[4][num_of_columns];
+    for (int c = 0; c != num_of_columns; ++c) {
+        double lo = table[c], hi = table[c], sum = 0;
+        for (int rank = 0; rank != nproc; ++rank) {
+            double value = table[(size_t)rank * num_of_columns + c];
+            lo = std::min(lo, value), hi = std::max(hi, value), sum += value;
+        }
+        stats[0][c] = lo, stats[1][c] = sum / nproc, stats[2][c] = hi;
+        stats[3][c] = sum > 0 ? hi * nproc / sum : 1;
+    }
+    const char *stat_names[4] = {"min", "avg", "max", "max/avg"};
+    for (int i = 0; i != 4; ++i) {
+        printf("%-8s", stat_names[i]);
+        for (int c = 0; c != num_of_columns; ++c)
+            printf("%12.4g", stats[i][c]);
+        printf("\n");
+    }
+}
+
+// Sparse exchanges are used while the encoded deltas of all ranks together
+// are smaller than this fraction of the board, the dense reduction otherwise
+#define SPARSE_EXCHANGE_LIMIT 0.5
+
+struct NodeGrids;
+
+struct CostExchange {
+    MPI_Comm comm;
+    // Set when the grids are shared by the ranks of a node
+    const NodeGrids *node = nullptr;
+    int num_of_cells;
+    std::vector<cost_t> delta;
+    std::vector<int> encoded;
+    std::vector<int> counts, displs;
+    std::vector<int> received;
+};
+
+// Ranks outside comm (MPI_COMM_NULL) take no part in the exchange
+static CostExchange make_cost_exchange(MPI_Comm comm, int num_of_cells) {
+    CostExchange exchange;
+    exchange.comm = comm;
+    exchange.num_of_cells = num_of_cells;
+    if (comm == MPI_COMM_NULL)
+        return exchange;
+    int nproc;
+    MPI_Comm_size(comm, &nproc);
+    exchange.delta.resize(num_of_cells);
+    exchange.counts.resize(nproc);
+    exchange.displs.resize(nproc);
+    return exchange;
+}
+
+// Encodes the nonzero deltas as runs of consecutive cells:
+// [cells skipped since the previous run, run length, values...]
+static void encode_delta(const cost_t *delta, int num_of_cells, std::vector<int> &encoded) {
+    encoded.clear();
+    int prev_end = 0;
+    for (int i = 0; i != num_of_cells;) {
+        if (delta[i] == 0) {
+            ++i;
+            continue;
+        }
+        int run_begin = i;
+        while (i != num_of_cells && delta[i] != 0)
+            ++i;
+        encoded.push_back(run_begin - prev_end);
+        encoded.push_back(i - run_begin);
+        encoded.insert(encoded.end(), delta + run_begin, delta + i);
+        prev_end = i;
+    }
+}
+
+// Adds the changes every rank made to its working copy since the last
+// synchronization into the consistent grid, and restarts the working copy from it
+static void exchange_costs(cost_t *costs, cost_t *new_costs, CostExchange &exchange) {
+    int num_of_cells = exchange.num_of_cells;
+    cost_t *delta = exchange.delta.data();
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i != num_of_cells; ++i)
+        delta[i] = new_costs[i] - costs[i];
+
+    encode_delta(delta, num_of_cells, exchange.encoded);
+    int encoded_size = exchange.encoded.size();
+    track(sizeof(int), exchange.counts.size() * sizeof(int), [&] {
+        MPI_Allgather(&encoded_size, 1, MPI_INT, exchange.counts.data(), 1, MPI_INT, exchange.comm);
+    });
+
+    int64_t total_size = 0;
+    for (size_t i = 0; i != exchange.counts.size(); ++i) {
+        exchange.displs[i] = total_size;
+        total_size += exchange.counts[i];
+    }
+
+    if (total_size >= SPARSE_EXCHANGE_LIMIT * num_of_cells) {
+        track(num_of_cells * sizeof(int), num_of_cells * sizeof(int), [&] {
+            MPI_Allreduce(MPI_IN_PLACE, delta, num_of_cells, MPI_INT, MPI_SUM, exchange.comm);
+        });
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i != num_of_cells; ++i)
+            costs[i] += delta[i];
+        memcpy(new_costs, costs, num_of_cells * sizeof(cost_t));
+        return;
+    }
+
+    exchange.received.resize(total_size);
+    track(encoded_size * sizeof(int), total_size * sizeof(int), [&] {
+        MPI_Allgatherv(exchange.encoded.data(), encoded_size, MPI_INT, exchange.received.data(),
+                       exchange.counts.data(), exchange.displs.data(), MPI_INT, exchange.comm);
+    });
+
+    // Only cells some rank changed differ between the grids, so both are
+    // updated in place. The own deltas come back as well, which keeps the
+    // working copy equal to the consistent grid.
+    const int *run = exchange.received.data();
+    for (size_t i = 0; i != exchange.counts.size(); ++i) {
+        const int *end = run + exchange.counts[i];
+        int cell = 0;
+        while (run != end) {
+            cell += run[0];
+            int run_length = run[1];
+            run += 2;
+            for (int j = 0; j != run_length; ++j, ++cell) {
+                costs[cell] += run[j];
+                new_costs[cell] = costs[cell];
+            }
+            run += run_length;
+        }
+    }
+}
+
+/* Node-shared grids: the ranks of a node keep one consistent grid and one
+ * working grid in an MPI_Win_allocate_shared window, commit routes to the
+ * working grid with atomics, and only the node leaders synchronize across
+ * nodes */
+
+struct NodeGrids {
+    MPI_Comm node_comm;   // ranks sharing the node
+    MPI_Comm leader_comm; // rank 0 of every node, MPI_COMM_NULL elsewhere
+    MPI_Win win;
+    cost_t *costs, *new_costs;
+};
+
+static NodeGrids make_node_grids(int procID, int num_of_cells) {
+    NodeGrids grids;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, procID, MPI_INFO_NULL, &grids.node_comm);
+    int node_rank;
+    MPI_Comm_rank(grids.node_comm, &node_rank);
+    MPI_Comm_split(MPI_COMM_WORLD, node_rank == 0 ? 0 : MPI_UNDEFINED, procID, &grids.leader_comm);
+
+    // The leader holds both grids, the other ranks map its segment
+    MPI_Aint size = node_rank == 0 ? 2 * (MPI_Aint)num_of_cells * sizeof(cost_t) : 0;
+    cost_t *base;
+    int disp_unit;
+    MPI_Win_allocate_shared(size, sizeof(cost_t), MPI_INFO_NULL, grids.node_comm, &base, &grids.win);
+    MPI_Win_shared_query(grids.win, 0, &size, &disp_unit, &base);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, grids.win);
+    grids.costs = base;
+    grids.new_costs = base + num_of_cells;
+    return grids;
+}
+
+static void free_node_grids(NodeGrids &grids) {
+    MPI_Win_unlock_all(grids.win);
+    MPI_Win_free(&grids.win);
+    if (grids.leader_comm != MPI_COMM_NULL)
+        MPI_Comm_free(&grids.leader_comm);
+    MPI_Comm_free(&grids.node_comm);
+}
+
+// Makes the stores of every rank of the node visible to the others
+static void node_barrier(const NodeGrids &grids) {
+    MPI_Win_sync(grids.win);
+    track(0, 0, [&] { MPI_Barrier(grids.node_comm); });
+    MPI_Win_sync(grids.win);
+}
+
+static void synchronize_costs(cost_t *costs, cost_t *new_costs, CostExchange &exchange) {
+    Phase prev_phase = enter_phase(PHASE_SYNC);
+    if (!exchange.node) {
+        exchange_costs(costs, new_costs, exchange);
+    } else {
+        // Changes within the node are already in the shared working grid
+        node_barrier(*exchange.node);
+        if (exchange.comm != MPI_COMM_NULL)
+            exchange_costs(costs, new_costs, exchange);
+        node_barrier(*exchange.node);
+    }
+    enter_phase(prev_phase);
+}
+
+/* Overlapped synchronization: the changes of batch k are exchanged while batch
+ * k + 1 is routed against the last consistent grid plus the rank's own
+ * changes, and applied at the next synchronization point. Sparse exchanges
+ * need the encoded sizes first, so an exchange goes through two nonblocking
+ * stages, advanced by MPI_Test between wires. */
+
+enum ExchangeStage { EXCHANGE_IDLE, EXCHANGE_COUNTS, EXCHANGE_DATA };
+
+struct PendingExchange {
+    ExchangeStage stage = EXCHANGE_IDLE;
+    bool sparse;
+    MPI_Request request = MPI_REQUEST_NULL;
+    std::vector<cost_t> own, global;
+    std::vector<int> encoded, counts, displs, received;
+    int encoded_size;
+    double post_time, wait_time;
+};
+
+struct OverlapStats {
+    double total_time = 0, exposed_time = 0;
+};
+
+static void advance_exchange(PendingExchange &pending, int num_of_cells) {
+    if (pending.stage != EXCHANGE_COUNTS)
+        return;
+    int64_t total_size = 0;
+    for (size_t i = 0; i != pending.counts.size(); ++i) {
+        pending.displs[i] = total_size;
+        total_size += pending.counts[i];
+    }
+    pending.sparse = total_size < SPARSE_EXCHANGE_LIMIT * num_of_cells;
+    if (pending.sparse) {
+        pending.received.resize(total_size);
+        MPI_Iallgatherv(pending.encoded.data(), pending.encoded_size, MPI_INT, pending.received.data(),
+                        pending.counts.data(), pending.displs.data(), MPI_INT, MPI_COMM_WORLD, &pending.request);
+    } else {
+        pending.global.resize(num_of_cells);
+        MPI_Iallreduce(pending.own.data(), pending.global.data(), num_of_cells, MPI_INT, MPI_SUM, MPI_COMM_WORLD, &pending.request);
+    }
+    pending.stage = EXCHANGE_DATA;
+}
+
+// Lets an in-flight exchange move on without blocking
+static void progress_exchange(PendingExchange &pending, int num_of_cells) {
+    if (pending.stage == EXCHANGE_IDLE)
+        return;
+    int done = 0;
+    MPI_Test(&pending.request, &done, MPI_STATUS_IGNORE);
+    if (done && pending.stage == EXCHANGE_COUNTS) {
+        advance_exchange(pending, num_of_cells);
+        MPI_Test(&pending.request, &done, MPI_STATUS_IGNORE);
+    }
+    if (done && pending.stage == EXCHANGE_DATA && pending.wait_time < 0)
+        pending.wait_time = MPI_Wtime();
+}
+
+static void post_exchange(PendingExchange &pending, int num_of_cells) {
+    encode_delta(pending.own.data(), num_of_cells, pending.encoded);
+    pending.encoded_size = pending.encoded.size();
+    pending.post_time = MPI_Wtime();
+    pending.wait_time = -1;
+    MPI_Iallgather(&pending.encoded_size, 1, MPI_INT, pending.counts.data(), 1, MPI_INT, MPI_COMM_WORLD, &pending.request);
+    pending.stage = EXCHANGE_COUNTS;
+}
+
+// Waits for an exchange and adds everyone else's changes to the working copy
+// (and mark), and all changes to the consistent grid
+static void complete_exchange(PendingExchange &pending, int procID, cost_t *costs, cost_t *new_costs, cost_t *mark, int num_of_cells, OverlapStats &stats) {
+    if (pending.stage == EXCHANGE_IDLE)
+        return;
+    double wait_start = MPI_Wtime();
+    track(0, 0, [&] { MPI_Wait(&pending.request, MPI_STATUS_IGNORE); });
+    if (pending.stage == EXCHANGE_COUNTS) {
+        advance_exchange(pending, num_of_cells);
+        track(0, 0, [&] { MPI_Wait(&pending.request, MPI_STATUS_IGNORE); });
+    }
+    if (pending.sparse) {
+        telemetry.bytes_sent += pending.encoded_size * sizeof(int);
+        telemetry.bytes_received += pending.received.size() * sizeof(int);
+    } else {
+        telemetry.bytes_sent += num_of_cells * sizeof(int);
+        telemetry.bytes_received += num_of_cells * sizeof(int);
+    }
+    double done_time = pending.wait_time >= 0 ? pending.wait_time : MPI_Wtime();
+    stats.total_time += done_time - pending.post_time;
+    stats.exposed_time += pending.wait_time >= 0 ? 0 : done_time - wait_start;
+    pending.stage = EXCHANGE_IDLE;
+
+    if (!pending.sparse) {
+        for (int i = 0; i != num_of_cells; ++i) {
+            cost_t others = pending.global[i] - pending.own[i];
+            costs[i] += pending.global[i];
+            new_costs[i] += others;
+            mark[i] += others;
+        }
+        return;
+    }
+
+    const int *run = pending.received.data();
+    for (int rank = 0; rank != (int)pending.counts.size(); ++rank) {
+        const int *end = run + pending.counts[rank];
+        int cell = 0;
+        while (run != end) {
+            cell += run[0];
+            int run_length = run[1];
+            run += 2;
+            for (int j = 0; j != run_length; ++j, ++cell) {
+                costs[cell] += run[j];
+                if (rank != procID) {
+                    new_costs[cell] += run[j];
+                    mark[cell] += run[j];
+                }
+            }
+            run += run_length;
+        }
+    }
+}
+
+// Starts exchanging the changes made since the previous synchronization point
+// after applying the exchange that was started there
+static void overlap_costs(PendingExchange *pending, int sync_id, int procID, cost_t *costs, cost_t *new_costs, cost_t *mark, int num_of_cells, OverlapStats &stats) {
+    Phase prev_phase = enter_phase(PHASE_SYNC);
+    PendingExchange &current = pending[sync_id % 2];
+    for (int i = 0; i != num_of_cells; ++i)
+        current.own[i] = new_costs[i] - mark[i];
+    memcpy(mark, new_costs, num_of_cells * sizeof(cost_t));
+    complete_exchange(pending[(sync_id + 1) % 2], procID, costs, new_costs, mark, num_of_cells, stats);
+    post_exchange(current, num_of_cells);
+    enter_phase(prev_phase);
+}
+
+static void write_outputs(const char *inputFilename, int nproc, Data data, int dim_y, const cost_t *costs, const Route *routes) {
+    int dim_x = data.dim_x, num_of_wires = data.num_of_wires;
+    std::string filename = std::string(basename((char *)inputFilename));
+    std::string name = filename.substr(0, filename.size() - 4);
+
+    // Write costs
+    std::ofstream costs_file("cost_" + name + "_" + std::to_string(nproc) + ".txt");
+    costs_file << dim_x << " " << dim_y << "\n";
+    for (int i = 0; i != dim_x * dim_y; ++i) {
+        costs_file << (uint32_t)costs[i] << ((i % dim_y == dim_y - 1) ? "\n" : " ");
+    }
+    costs_file.close();
+
+    // Write wires
+    std::ofstream wires_file("output_" + name + "_" + std::to_string(nproc) + ".txt");
+    wires_file << dim_x << " " << dim_y << "\n"
+               << num_of_wires << "\n";
+    for (int i = 0; i != num_of_wires; ++i)
+        wires_file << routes[i] << "\n";
+    wires_file.close();
+}
+
+/* Collective I/O. Binary netlists (".bin": int32 dim_x, dim_y, num_of_wires,
+ * then start_x, start_y, end_x, end_y per wire) are read by every rank at the
+ * offset of its slice. Both outputs are written by all ranks at offsets agreed
+ * on with a scan, in the same text format as write_outputs. */
+
+#define NETLIST_HEADER_INTS 3
+#define NETLIST_WIRE_INTS 4
+
+static bool is_binary_netlist(const char *filename) {
+    size_t len = strlen(filename);
+    return len >= 4 && strcmp(filename + len - 4, ".bin") == 0;
+}
+
+// Converts a text netlist to the binary format, on one rank
+int convert_netlist(const char *inputFilename, const char *outputFilename) {
+    std::ifstream input_file(inputFilename);
+    if (!input_file.is_open()) {
+        printf("Unable to open file: %s.\n", inputFilename);
+        return 1;
+    }
+    int header[NETLIST_HEADER_INTS];
+    input_file >> header[0] >> header[1] >> header[2];
+    std::vector<int32_t> values(NETLIST_HEADER_INTS + (size_t)header[2] * NETLIST_WIRE_INTS);
+    std::copy(header, header + NETLIST_HEADER_INTS, values.begin());
+    for (size_t i = NETLIST_HEADER_INTS; i != values.size(); ++i)
+        input_file >> values[i];
+
+    FILE *output = fopen(outputFilename, "wb");
+    if (!output) {
+        printf("Unable to open file: %s.\n", outputFilename);
+        return 1;
+    }
+    fwrite(values.data(), sizeof(int32_t), values.size(), output);
+    fclose(output);
+    return 0;
+}
+
+// Reads the wires [wire_begin, wire_end) of a binary netlist, after its header.
+// Fails on every rank when the header is invalid, or when any rank reads a
+// short or off-board slice.
+static bool read_netlist_slice(const char *inputFilename, int *header, int nproc, int procID, std::vector<Wire> &slice, int &wire_begin) {
+    MPI_File file;
+    if (MPI_File_open(MPI_COMM_WORLD, inputFilename, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+        return false;
+    // collective reads may report the requested count past the end of the
+    // file, so the size is checked up front as well
+    MPI_Offset file_size = 0;
+    MPI_File_get_size(file, &file_size);
+    MPI_Status status;
+    int count = 0;
+    bool ok = file_size >= (MPI_Offset)(NETLIST_HEADER_INTS * sizeof(int32_t)) &&
+              MPI_File_read_at_all(file, 0, header, NETLIST_HEADER_INTS, MPI_INT, &status) == MPI_SUCCESS &&
+              MPI_Get_count(&status, MPI_INT, &count) == MPI_SUCCESS && count == NETLIST_HEADER_INTS;
+    // every rank reads the same header, so they all agree on giving up here
+    int dim_x = header[0], dim_y = header[1], num_of_wires = header[2];
+    if (!ok || dim_x <= 0 || dim_y <= 0 || num_of_wires < 0 ||
+        file_size < (NETLIST_HEADER_INTS + (MPI_Offset)num_of_wires * NETLIST_WIRE_INTS) * (MPI_Offset)sizeof(int32_t)) {
+        MPI_File_close(&file);
+        return false;
+    }
+
+    wire_begin = (int)((int64_t)num_of_wires * procID / nproc);
+    int wire_end = (int)((int64_t)num_of_wires * (procID + 1) / nproc);
+    std::vector<int32_t> values((size_t)(wire_end - wire_begin) * NETLIST_WIRE_INTS);
+    MPI_Offset offset = (NETLIST_HEADER_INTS + (MPI_Offset)wire_begin * NETLIST_WIRE_INTS) * sizeof(int32_t);
+    ok = MPI_File_read_at_all(file, offset, values.data(), values.size(), MPI_INT, &status) == MPI_SUCCESS &&
+         MPI_Get_count(&status, MPI_INT, &count) == MPI_SUCCESS && count == (int)values.size();
+    MPI_File_close(&file);
+
+    slice.clear();
+    for (int i = 0; ok && i != wire_end - wire_begin; ++i) {
+        const int32_t *v = &values[(size_t)i * NETLIST_WIRE_INTS];
+        ok = v[0] >= 0 && v[0] < dim_x && v[1] >= 0 && v[1] < dim_y && v[2] >= 0 && v[2] < dim_x && v[3] >= 0 && v[3] < dim_y;
+        slice.push_back({{v[0], v[1]}, {v[2], v[3]}, wire_begin + i});
+    }
+    int all_ok = ok;
+    MPI_Allreduce(MPI_IN_PLACE, &all_ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    return all_ok;
+}
+
+// Writes the bytes of every rank back to back, in rank order
+static void write_ordered(MPI_File file, const std::string &text) {
+    long long size = text.size(), offset = 0;
+    MPI_Exscan(&size, &offset, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    int procID;
+    MPI_Comm_rank(MPI_COMM_WORLD, &procID);
+    if (procID == 0)
+        offset = 0;
+    MPI_File_write_at_all(file, offset, text.data(), text.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+}
+
+static MPI_File create_output(const std::string &filename) {
+    MPI_File file;
+    MPI_File_open(MPI_COMM_WORLD, filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file);
+    MPI_File_set_size(file, 0);
+    return file;
+}
+
+// Every rank holds the whole grid and the routes of local_wires; the cost
+// lines are split into bands by rank and every route is written by its owner
+static void write_outputs_collective(const char *inputFilename, int procID, int nproc, Data data, int dim_y, const cost_t *costs, const Route *routes, const int *local_wires, int num_of_local_wires) {
+    int dim_x = data.dim_x, num_of_wires = data.num_of_wires;
+    std::string filename = std::string(basename((char *)inputFilename));
+    std::string name = filename.substr(0, filename.size() - 4);
+    std::string header = std::to_string(dim_x) + " " + std::to_string(dim_y) + "\n";
+
+    // Write costs
+    MPI_File costs_file = create_output("cost_" + name + "_" + std::to_string(nproc) + ".txt");
+    // as in the baseline output, dim_x lines of dim_y values each, so a
+    // band is a range of whole lines
+    int line_begin = (int)((int64_t)dim_x * procID / nproc);
+    int line_end = (int)((int64_t)dim_x * (procID + 1) / nproc);
+    std::string text = procID == 0 ? header : "";
+    for (int i = line_begin * dim_y; i != line_end * dim_y; ++i) {
+        text += std::to_string((uint32_t)costs[i]);
+        text += (i % dim_y == dim_y - 1) ? '\n' : ' ';
+    }
+    write_ordered(costs_file, text);
+    MPI_File_close(&costs_file);
+
+    // Write wires: the line lengths of all routes give every line its offset
+    std::vector<int> ids(local_wires, local_wires + num_of_local_wires);
+    std::sort(ids.begin(), ids.end());
+    std::vector<int> line_sizes(num_of_wires, 0);
+    text.clear();
+    for (int wire_id : ids) {
+        std::ostringstream line;
+        line << routes[wire_id] << "\n";
+        line_sizes[wire_id] = line.str().size();
+        text += line.str();
+    }
+    MPI_Allreduce(MPI_IN_PLACE, line_sizes.data(), num_of_wires, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+    header += std::to_string(num_of_wires) + "\n";
+    std::vector<MPI_Aint> line_offsets(num_of_wires);
+    MPI_Aint offset = header.size();
+    for (int i = 0; i != num_of_wires; ++i) {
+        line_offsets[i] = offset;
+        offset += line_sizes[i];
+    }
+
+    // File view of the local lines, which are sorted as views require
+    std::vector<int> block_sizes;
+    std::vector<MPI_Aint> block_offsets;
+    if (procID == 0) {
+        block_sizes.push_back(header.size());
+        block_offsets.push_back(0);
+        text = header + text;
+    }
+    for (int wire_id : ids) {
+        block_sizes.push_back(line_sizes[wire_id]);
+        block_offsets.push_back(line_offsets[wire_id]);
+    }
+    MPI_Datatype view;
+    MPI_Type_create_hindexed(block_sizes.size(), block_sizes.data(), block_offsets.data(), MPI_CHAR, &view);
+    MPI_Type_commit(&view);
+
+    MPI_File wires_file = create_output("output_" + name + "_" + std::to_string(nproc) + ".txt");
+    MPI_File_set_view(wires_file, 0, MPI_CHAR, view, "native", MPI_INFO_NULL);
+    MPI_File_write_all(wires_file, text.data(), text.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+    MPI_File_close(&wires_file);
+    MPI_Type_free(&view);
+}
+
+// Best of a ripped-up route and every candidate of its wire under Objective.
+// The incumbent is rescored, so it ranks by the same objective as the others.
+template <class Objective>
+static Route best_candidate(int dim_x, cost_t *costs, Route best_route, bool parallel) {
+    Wire wire = best_route.wire;
+    best_route.metrics = walk_route<WALK_SCORE, Objective>(dim_x, costs, best_route);
+
+    int routes_len = num_of_candidates(wire);
+#pragma omp declare reduction(min_route:Route \
+                              : omp_out = Objective::less(omp_in.metrics, omp_out.metrics) ? omp_in : omp_out)
+#pragma omp parallel for schedule(guided) if (parallel) reduction(min_route \
+                                                                   : best_route)
+    for (int route_id = 0; route_id < routes_len; ++route_id) {
+        Route new_route = candidate_route(wire, route_id);
+        new_route.metrics = walk_route<WALK_SCORE, Objective>(dim_x, costs, new_route);
+        if (Objective::less(new_route.metrics, best_route.metrics)) {
+            best_route = new_route;
+        }
+    }
+    return best_route;
+}
+
+/* Spatial domain decomposition
+ *
+ * The board is split into a Cartesian grid of blocks, one per rank. Each rank
+ * stores only its block plus a halo of neighbor cells, in a local grid whose
+ * rows are the extended block's width. A wire belongs to the rank whose block
+ * covers most of its bounding box and is routed locally when that box fits
+ * into the owner's block and halo. All other wires cross blocks: every rank
+ * scores their candidates on the cells it owns and the partial metrics are
+ * combined with an MPI_Allreduce, so all ranks pick the same route. */
+
+struct Rect {
+    int x0, x1, y0, y1; // [x0, x1) x [y0, y1)
+    int area() const { return std::max(0, x1 - x0) * std::max(0, y1 - y0); }
+};
+
+struct Block {
+    MPI_Comm cart;
+    int dims[2], coords[2];
+    // block i along an axis covers [bounds[i], bounds[i + 1])
+    std::vector<int> x_bounds, y_bounds;
+    int halo;
+    Rect owned, extended;
+    // neighbors in MPI_Neighbor_alltoallv order: x-, x+, y-, y+
+    int neighbors[4];
+};
+
+static Rect extended_rect(const Block &block, int dim_x, int dim_y, int cx, int cy) {
+    return {std::max(0, block.x_bounds[cx] - block.halo), std::min(dim_x, block.x_bounds[cx + 1] + block.halo),
+            std::max(0, block.y_bounds[cy] - block.halo), std::min(dim_y, block.y_bounds[cy + 1] + block.halo)};
+}
+
+static Block make_block(int procID, int nproc, int dim_x, int dim_y, int halo) {
+    Block block;
+    block.dims[0] = block.dims[1] = 0;
+    MPI_Dims_create(nproc, 2, block.dims);
+    int periods[2] = {0, 0};
+    MPI_Cart_create(MPI_COMM_WORLD, 2, block.dims, periods, 0, &block.cart);
+    MPI_Cart_coords(block.cart, procID, 2, block.coords);
+
+    for (int i = 0; i <= block.dims[0]; ++i)
+        block.x_bounds.push_back((int64_t)dim_x * i / block.dims[0]);
+    for (int i = 0; i <= block.dims[1]; ++i)
+        block.y_bounds.push_back((int64_t)dim_y * i / block.dims[1]);
+
+    // Halos may not reach past the adjacent block
+    block.halo = std::min({halo, dim_x / block.dims[0], dim_y / block.dims[1]});
+
+    int cx = block.coords[0], cy = block.coords[1];
+    block.owned = {block.x_bounds[cx], block.x_bounds[cx + 1], block.y_bounds[cy], block.y_bounds[cy + 1]};
+    block.extended = extended_rect(block, dim_x, dim_y, cx, cy);
+    MPI_Cart_shift(block.cart, 0, 1, &block.neighbors[0], &block.neighbors[1]);
+    MPI_Cart_shift(block.cart, 1, 1, &block.neighbors[2], &block.neighbors[3]);
+    return block;
+}
+
+// Rank whose block covers most of the wire's bounding box
+static int owner_of(const Block &block, Wire wire) {
+    Rect box = {std::min(wire.start.x, wire.end.x), std::max(wire.start.x, wire.end.x) + 1,
+                std::min(wire.start.y, wire.end.y), std::max(wire.start.y, wire.end.y) + 1};
+    int best_area = -1, best_coords[2] = {0, 0};
+    for (int cy = 0; cy != block.dims[1]; ++cy) {
+        for (int cx = 0; cx != block.dims[0]; ++cx) {
+            Rect overlap = {std::max(box.x0, block.x_bounds[cx]), std::min(box.x1, block.x_bounds[cx + 1]),
+                            std::max(box.y0, block.y_bounds[cy]), std::min(box.y1, block.y_bounds[cy + 1])};
+            if (overlap.area() > best_area) {
+                best_area = overlap.area();
+                best_coords[0] = cx;
+                best_coords[1] = cy;
+            }
+        }
+    }
+    int owner;
+    MPI_Cart_rank(block.cart, best_coords, &owner);
+    return owner;
+}
+
+static bool fits_in(Rect rect, Wire wire) {
+    return std::min(wire.start.x, wire.end.x) >= rect.x0 && std::max(wire.start.x, wire.end.x) < rect.x1 &&
+           std::min(wire.start.y, wire.end.y) >= rect.y0 && std::max(wire.start.y, wire.end.y) < rect.y1;
+}
+
+static inline int local_index(const Block &block, int x, int y) {
+    return (y - block.extended.y0) * (block.extended.x1 - block.extended.x0) + (x - block.extended.x0);
+}
+
+static Route shift_route(Route route, int dx, int dy) {
+    for (Point *p : {&route.wire.start, &route.wire.end, &route.p1, &route.p2}) {
+        p->x += dx;
+        p->y += dy;
+    }
+    return route;
+}
+
+// Walks the cells of [p1, p2) that this rank owns
+template <WalkMode mode, class Objective = MaxThenSum>
+static void walk_owned_segment(const Block &block, cost_t *local, Point p1, Point p2, Metrics &metrics) {
+    if (p1 == p2)
+        return;
+    const Rect &owned = block.owned;
+    if (p1.x == p2.x) {
+        if (p1.x < owned.x0 || p1.x >= owned.x1)
+            return;
+        // [lo, hi] are the rows of the segment, p2 excluded
+        int lo = std::min(p1.y, p2.y + (p2.y > p1.y ? -1 : 1)), hi = std::max(p1.y, p2.y + (p2.y > p1.y ? -1 : 1));
+        for (int y = std::max(lo, owned.y0); y <= std::min(hi, owned.y1 - 1); ++y)
+            Objective::update(metrics, walk_cell<mode>(local + local_index(block, p1.x, y)));
+    } else {
+        if (p1.y < owned.y0 || p1.y >= owned.y1)
+            return;
+        int lo = std::min(p1.x, p2.x + (p2.x > p1.x ? -1 : 1)), hi = std::max(p1.x, p2.x + (p2.x > p1.x ? -1 : 1));
+        for (int x = std::max(lo, owned.x0); x <= std::min(hi, owned.x1 - 1); ++x)
+            Objective::update(metrics, walk_cell<mode>(local + local_index(block, x, p1.y)));
+    }
+}
+
+// Partial metrics of a route over the owned cells; max and sum combine across ranks
+template <WalkMode mode, class Objective = MaxThenSum>
+static Metrics walk_owned(const Block &block, cost_t *local, const Route &route) {
+    Metrics metrics;
+    Point end = route.wire.end;
+    walk_owned_segment<mode, Objective>(block, local, route.wire.start, route.p1, metrics);
+    walk_owned_segment<mode, Objective>(block, local, route.p1, route.p2, metrics);
+    walk_owned_segment<mode, Objective>(block, local, route.p2, end, metrics);
+    walk_owned_segment<mode, Objective>(block, local, end, {end.x + 1, end.y}, metrics);
+    return metrics;
+}
+
+static void combine_metrics(void *in, void *inout, int *len, MPI_Datatype *) {
+    Metrics *lhs = (Metrics *)in, *rhs = (Metrics *)inout;
+    for (int i = 0; i != *len; ++i)
+        rhs[i].update(lhs[i]);
+}
+
+static void pack_rect(const Block &block, const cost_t *grid, Rect rect, std::vector<int> &buf) {
+    for (int y = rect.y0; y < rect.y1; ++y)
+        for (int x = rect.x0; x < rect.x1; ++x)
+            buf.push_back(grid[local_index(block, x, y)]);
+}
+
+// One neighborhood exchange along an axis. Forward exchanges copy the edge of
+// the owned block into the neighbors' halos; reverse exchanges send the halo
+// back and add it onto the owner's edge.
+static void exchange_halo(const Block &block, int axis, cost_t *grid, bool reverse) {
+    const Rect &o = block.owned, &e = block.extended;
+    int h = block.halo;
+    Rect halo[4], edge[4];
+    for (int i = 0; i != 4; ++i)
+        halo[i] = edge[i] = {0, 0, 0, 0};
+    if (axis == 0) {
+        halo[0] = {o.x0 - h, o.x0, o.y0, o.y1}, edge[0] = {o.x0, o.x0 + h, o.y0, o.y1};
+        halo[1] = {o.x1, o.x1 + h, o.y0, o.y1}, edge[1] = {o.x1 - h, o.x1, o.y0, o.y1};
+    } else {
+        halo[2] = {e.x0, e.x1, o.y0 - h, o.y0}, edge[2] = {e.x0, e.x1, o.y0, o.y0 + h};
+        halo[3] = {e.x0, e.x1, o.y1, o.y1 + h}, edge[3] = {e.x0, e.x1, o.y1 - h, o.y1};
+    }
+
+    std::vector<int> send_buf, recv_buf;
+    int send_counts[4], send_displs[4], recv_counts[4], recv_displs[4];
+    int recv_size = 0;
+    for (int i = 0; i != 4; ++i) {
+        bool exists = block.neighbors[i] != MPI_PROC_NULL;
+        Rect send = reverse ? halo[i] : edge[i];
+        send_displs[i] = send_buf.size();
+        if (exists)
+            pack_rect(block, grid, send, send_buf);
+        send_counts[i] = send_buf.size() - send_displs[i];
+        recv_displs[i] = recv_size;
+        recv_counts[i] = exists ? (reverse ? edge[i] : halo[i]).area() : 0;
+        recv_size += recv_counts[i];
+    }
+    recv_buf.resize(recv_size);
+    track(send_buf.size() * sizeof(int), recv_size * sizeof(int), [&] {
+        MPI_Neighbor_alltoallv(send_buf.data(), send_counts, send_displs, MPI_INT,
+                               recv_buf.data(), recv_counts, recv_displs, MPI_INT, block.cart);
+    });
+
+    for (int i = 0; i != 4; ++i) {
+        if (recv_counts[i] == 0)
+            continue;
+        Rect recv = reverse ? edge[i] : halo[i];
+        const int *value = recv_buf.data() + recv_displs[i];
+        for (int y = recv.y0; y < recv.y1; ++y) {
+            for (int x = recv.x0; x < recv.x1; ++x, ++value) {
+                if (reverse)
+                    grid[local_index(block, x, y)] += *value;
+                else
+                    grid[local_index(block, x, y)] = *value;
+            }
+        }
+    }
+}
+
+static void refresh_block(const Block &block, cost_t *local, cost_t *snapshot, int num_of_cells) {
+    exchange_halo(block, 0, local, false);
+    exchange_halo(block, 1, local, false);
+    memcpy(snapshot, local, num_of_cells * sizeof(cost_t));
+}
+
+// Forwards every halo change to the owner of the cell, then refreshes all
+// halos from the owners. Going along y before x on the way in (and x before y
+// on the way out) carries corner cells over the diagonal neighbor.
+static void synchronize_block(const Block &block, cost_t *local, cost_t *snapshot, cost_t *delta, int num_of_cells) {
+    Phase prev_phase = enter_phase(PHASE_SYNC);
+    for (int i = 0; i != num_of_cells; ++i)
+        delta[i] = local[i] - snapshot[i];
+    exchange_halo(block, 1, delta, true);
+    exchange_halo(block, 0, delta, true);
+    const Rect &o = block.owned;
+    for (int y = o.y0; y < o.y1; ++y)
+        for (int x = o.x0; x < o.x1; ++x)
+            local[local_index(block, x, y)] = snapshot[local_index(block, x, y)] + delta[local_index(block, x, y)];
+    refresh_block(block, local, snapshot, num_of_cells);
+    enter_phase(prev_phase);
+}
+
+static void compute_decomposed(int procID, int nproc, const char *inputFilename, Options options, Data data, int dim_y, Route *routes) {
+    const int root = 0;
+    int dim_x = data.dim_x, num_of_wires = data.num_of_wires;
+    Wire *wires = data.wires;
+
+    Block block = make_block(procID, nproc, dim_x, dim_y, options.halo_width);
+    const Rect &owned = block.owned;
+    int local_dim_x = block.extended.x1 - block.extended.x0;
+    int num_of_cells = block.extended.area();
+    cost_t *local = (cost_t *)calloc(num_of_cells, sizeof(cost_t));
+    cost_t *snapshot = (cost_t *)calloc(num_of_cells, sizeof(cost_t));
+    cost_t *delta = (cost_t *)calloc(num_of_cells, sizeof(cost_t));
+
+    // Wire ownership is decided identically on every rank
+    std::vector<int> local_wire_ids, cross_wire_ids;
+    for (int wire_id = 0; wire_id != num_of_wires; ++wire_id) {
+        int owner = owner_of(block, wires[wire_id]);
+        int owner_coords[2];
+        MPI_Cart_coords(block.cart, owner, 2, owner_coords);
+        if (!fits_in(extended_rect(block, dim_x, dim_y, owner_coords[0], owner_coords[1]), wires[wire_id]))
+            cross_wire_ids.push_back(wire_id);
+        else if (owner == procID)
+            local_wire_ids.push_back(wire_id);
+    }
+
+    for (int wire_id = 0; wire_id != num_of_wires; ++wire_id)
+        walk_owned<WALK_ADD>(block, local, routes[wire_id]);
+    refresh_block(block, local, snapshot, num_of_cells);
+
+    MPI_Op metrics_op;
+    MPI_Op_create(combine_metrics, 1, &metrics_op);
+
+    int num_of_batches = 1;
+    if (options.sync_interval > 0) {
+        int max_wires_per_proc = local_wire_ids.size();
+        MPI_Allreduce(MPI_IN_PLACE, &max_wires_per_proc, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+        num_of_batches = std::max(1, (max_wires_per_proc + options.sync_interval - 1) / options.sync_interval);
+    }
+    int num_of_local_wires = local_wire_ids.size();
+    int num_of_cross_wires = cross_wire_ids.size();
+    std::vector<char> cross_random(num_of_cross_wires);
+    std::vector<Route> cross_random_routes(num_of_cross_wires);
+    std::vector<Metrics> partial_metrics;
+    int max_cross_candidates = 0;
+    for (int wire_id : cross_wire_ids)
+        max_cross_candidates = std::max(max_cross_candidates, num_of_candidates(wires[wire_id]));
+    partial_metrics.reserve(max_cross_candidates);
+
+    double compute_start = MPI_Wtime();
+    enter_phase(PHASE_ROUTE);
+
+    for (int iter_id = 0; iter_id != options.SA_iters; ++iter_id) {
+        // Wires inside the owner's block and halo
+        for (int batch_id = 0; batch_id != num_of_batches; ++batch_id) {
+            int batch_begin = (int64_t)num_of_local_wires * batch_id / num_of_batches;
+            int batch_end = (int64_t)num_of_local_wires * (batch_id + 1) / num_of_batches;
+
+            for (int i = batch_begin; i < batch_end; ++i) {
+                int wire_id = local_wire_ids[i];
+                Route prev_route = shift_route(routes[wire_id], -block.extended.x0, -block.extended.y0);
+                prev_route.metrics = walk_route<WALK_REMOVE>(local_dim_x, local, prev_route);
+
+                Route best_route = prev_route;
+                if (is_random_route(options.SA_prob)) {
+                    best_route = generate_random_route(prev_route.wire);
+                } else {
+                    telemetry.candidates += num_of_candidates(prev_route.wire);
+                    best_route = with_objective(options.objective, [&](auto objective) {
+                        return best_candidate<decltype(objective)>(local_dim_x, local, prev_route, false);
+                    });
+                }
+                best_route.metrics = walk_route<WALK_ADD>(local_dim_x, local, best_route);
+                routes[wire_id] = shift_route(best_route, block.extended.x0, block.extended.y0);
+                ++telemetry.wires;
+            }
+
+            synchronize_block(block, local, snapshot, delta, num_of_cells);
+        }
+
+        // Wires crossing blocks, one at a time over all ranks. The root draws
+        // the annealing moves so that every rank takes the same ones.
+        if (procID == root) {
+            for (int i = 0; i != num_of_cross_wires; ++i) {
+                cross_random[i] = is_random_route(options.SA_prob);
+                cross_random_routes[i] = generate_random_route(wires[cross_wire_ids[i]]);
+            }
+        }
+        track(0, num_of_cross_wires * (1 + sizeof(Route)), [&] {
+            MPI_Bcast(cross_random.data(), num_of_cross_wires, MPI_CHAR, root, MPI_COMM_WORLD);
+            MPI_Bcast(cross_random_routes.data(), num_of_cross_wires * sizeof(Route), MPI_BYTE, root, MPI_COMM_WORLD);
+        });
+
+        for (int i = 0; i != num_of_cross_wires; ++i) {
+            int wire_id = cross_wire_ids[i];
+            walk_owned<WALK_REMOVE>(block, local, routes[wire_id]);
+
+            Route best_route = cross_random_routes[i];
+            if (!cross_random[i]) {
+                int num_of_routes = num_of_candidates(wires[wire_id]);
+                partial_metrics.resize(num_of_routes);
+                // ranks away from the wire only contribute empty metrics
+                Wire wire = wires[wire_id];
+                bool overlaps = std::max(wire.start.x, wire.end.x) >= owned.x0 && std::min(wire.start.x, wire.end.x) < owned.x1 &&
+                           std::max(wire.start.y, wire.end.y) >= owned.y0 && std::min(wire.start.y, wire.end.y) < owned.y1;
+                for (int route_id = 0; route_id != num_of_routes; ++route_id)
+                    partial_metrics[route_id] = overlaps ? with_objective(options.objective, [&](auto objective) {
+                        return walk_owned<WALK_SCORE, decltype(objective)>(block, local, candidate_route(wires[wire_id], route_id));
+                    })
+                                                         : Metrics();
+                track(num_of_routes * sizeof(Metrics), num_of_routes * sizeof(Metrics), [&] {
+                    MPI_Allreduce(MPI_IN_PLACE, partial_metrics.data(), num_of_routes, MPI_2INT, metrics_op, MPI_COMM_WORLD);
+                });
+                telemetry.candidates += num_of_routes;
+
+                best_route = routes[wire_id];
+                best_route.metrics = Metrics(MAX_COST, MAX_COST);
+                for (int route_id = 0; route_id != num_of_routes; ++route_id) {
+                    bool better = with_objective(options.objective, [&](auto objective) {
+                        return decltype(objective)::less(partial_metrics[route_id], best_route.metrics);
+                    });
+                    if (better) {
+                        best_route = candidate_route(wires[wire_id], route_id);
+                        best_route.metrics = partial_metrics[route_id];
+                    }
+                }
+            }
+            walk_owned<WALK_ADD>(block, local, best_route);
+            routes[wire_id] = best_route;
+            ++telemetry.wires;
+        }
+        Phase prev_phase = enter_phase(PHASE_SYNC);
+        refresh_block(block, local, snapshot, num_of_cells);
+        enter_phase(prev_phase);
+    }
+
+    double compute_time = MPI_Wtime() - compute_start;
+    enter_phase(PHASE_WRITE);
+
+    // Collect the locally routed wires and the owned blocks on the root
+    std::vector<Route> local_routes;
+    for (int wire_id : local_wire_ids)
+        local_routes.push_back(routes[wire_id]);
+    std::vector<int> owned_cells;
+    pack_rect(block, local, owned, owned_cells);
+
+    int counts[2] = {(int)(local_routes.size() * sizeof(Route)), (int)owned_cells.size()};
+    std::vector<int> all_counts(2 * nproc);
+    MPI_Gather(counts, 2, MPI_INT, all_counts.data(), 2, MPI_INT, root, MPI_COMM_WORLD);
+
+    std::vector<int> route_counts(nproc), route_displs(nproc), cell_counts(nproc), cell_displs(nproc);
+    int route_bytes = 0, cells = 0;
+    for (int i = 0; i != nproc; ++i) {
+        route_counts[i] = all_counts[2 * i], route_displs[i] = route_bytes, route_bytes += route_counts[i];
+        cell_counts[i] = all_counts[2 * i + 1], cell_displs[i] = cells, cells += cell_counts[i];
+    }
+    std::vector<Route> gathered_routes(procID == root ? route_bytes / sizeof(Route) : 0);
+    std::vector<int> gathered_cells(procID == root ? cells : 0);
+    MPI_Gatherv(local_routes.data(), counts[0], MPI_BYTE, gathered_routes.data(), route_counts.data(), route_displs.data(), MPI_BYTE, root, MPI_COMM_WORLD);
+    MPI_Gatherv(owned_cells.data(), counts[1], MPI_INT, gathered_cells.data(), cell_counts.data(), cell_displs.data(), MPI_INT, root, MPI_COMM_WORLD);
+
+    if (procID == root) {
+        for (const Route &route : gathered_routes)
+            routes[route.wire.id] = route;
+
+        cost_t *costs = (cost_t *)calloc(dim_x * dim_y, sizeof(cost_t));
+        for (int rank = 0; rank != nproc; ++rank) {
+            int coords[2];
+            MPI_Cart_coords(block.cart, rank, 2, coords);
+            const int *value = gathered_cells.data() + cell_displs[rank];
+            for (int y = block.y_bounds[coords[1]]; y < block.y_bounds[coords[1] + 1]; ++y)
+                for (int x = block.x_bounds[coords[0]]; x < block.x_bounds[coords[0] + 1]; ++x)
+                    costs[y * dim_x + x] = *value++;
+        }
+
+        printf("Computation Time: \t\t\t[%lf].\n", compute_time);
+        printf("Cross-block wires: \t\t\t[%d].\n", num_of_cross_wires);
+        std::cout << walk_all_routes(data, costs, routes, 0) << std::endl;
+        write_outputs(inputFilename, nproc, data, dim_y, costs, routes);
+    }
+    MPI_Op_free(&metrics_op);
+}
+
+/* Static partition: recursive coordinate bisection of the wire bounding-box
+ * centers, weighted by computation_cost, so that every rank routes a compact
+ * region of the board with about the same amount of work. Ranks whose wires
+ * do not overlap seldom update the same cells between synchronizations. */
+
+struct Partition {
+    std::vector<int> order;       // wire ids, grouped by rank
+    std::vector<int> rank_begin;  // rank r routes order[rank_begin[r], rank_begin[r + 1])
+    std::vector<uint64_t> workload;
+};
+
+// Twice the center of the bounding box, to stay in integers
+static inline int center2(const Wire &wire, int axis) {
+    return axis == 0 ? wire.start.x + wire.end.x : wire.start.y + wire.end.y;
+}
+
+static void bisect(const Wire *wires, Partition &partition, int begin, int end, int first_rank, int num_ranks) {
+    // no wires left to split: every rank of the range routes none
+    if (num_ranks == 1 || begin == end) {
+        for (int rank = first_rank; rank != first_rank + num_ranks; ++rank)
+            partition.rank_begin[rank] = begin;
+        return;
+    }
+
+    int *ids = partition.order.data();
+    int lo[2] = {INT32_MAX, INT32_MAX}, hi[2] = {INT32_MIN, INT32_MIN};
+    uint64_t total = 0;
+    for (int i = begin; i != end; ++i) {
+        for (int axis = 0; axis != 2; ++axis) {
+            lo[axis] = std::min(lo[axis], center2(wires[ids[i]], axis));
+            hi[axis] = std::max(hi[axis], center2(wires[ids[i]], axis));
+        }
+        total += wires[ids[i]].computation_cost;
+    }
+
+    // Cut across the longer extent, ties broken by id to be the same on every rank
+    int axis = hi[0] - lo[0] >= hi[1] - lo[1] ? 0 : 1;
+    std::sort(ids + begin, ids + end, [&](int a, int b) {
+        int ca = center2(wires[a], axis), cb = center2(wires[b], axis);
+        return ca != cb ? ca < cb : a < b;
+    });
+
+    int left_ranks = num_ranks / 2;
+    uint64_t left_target = total * left_ranks / num_ranks, accumulated = 0;
+    int split = begin;
+    while (split != end && accumulated + wires[ids[split]].computation_cost / 2 < left_target)
+        accumulated += wires[ids[split++]].computation_cost;
+
+    bisect(wires, partition, begin, split, first_rank, left_ranks);
+    bisect(wires, partition, split, end, first_rank + left_ranks, num_ranks - left_ranks);
+}
+
+// Deterministic, so every rank computes the same partition from the broadcast wires
+static Partition make_partition(const Wire *wires, int num_of_wires, int nproc) {
+    Partition partition;
+    partition.order.resize(num_of_wires);
+    partition.rank_begin.resize(nproc + 1);
+    partition.workload.assign(nproc, 0);
+    for (int i = 0; i != num_of_wires; ++i)
+        partition.order[i] = i;
+    bisect(wires, partition, 0, num_of_wires, 0, nproc);
+    partition.rank_begin[nproc] = num_of_wires;
+    for (int rank = 0; rank != nproc; ++rank)
+        for (int i = partition.rank_begin[rank]; i != partition.rank_begin[rank + 1]; ++i)
+            partition.workload[rank] += wires[partition.order[i]].computation_cost;
+    return partition;
+}
+
+// Candidates below which scoring stays on the calling thread
+#define PARALLEL_SCORE_MIN 64
+
+// Rips up the route of one wire and reroutes it on the working grid. The
+// candidates are scored by the threads of the rank.
+static void route_wire(Data data, cost_t *new_costs, Route *routes, int wire_id, const Options &options) {
+    bool shared = options.shared;
+    Wire wire = data.wires[wire_id];
+    Route prev_route = routes[wire_id];
+    prev_route.metrics = shared ? walk_a_route_atomic(data, new_costs, prev_route, -1) : walk_a_route(data, new_costs, prev_route, -1);
+
+    Route best_route = prev_route;
+    if (is_random_route(options.SA_prob)) {
+        best_route = generate_random_route(wire);
+    } else {
+        int routes_len = num_of_candidates(wire);
+        telemetry.candidates += routes_len;
+        best_route = with_objective(options.objective, [&](auto objective) {
+            return best_candidate<decltype(objective)>(data.dim_x, new_costs, prev_route, routes_len >= PARALLEL_SCORE_MIN);
+        });
+    }
+    best_route.metrics = shared ? walk_a_route_atomic(data, new_costs, best_route, 1) : walk_a_route(data, new_costs, best_route, 1);
+    routes[wire_id] = best_route;
+    ++telemetry.wires;
+}
+
+/* Dynamic scheduling: every annealing iteration hands out wires in chunks from
+ * a counter on the root, taken with MPI_Fetch_and_op so that the root never has
+ * to serve requests itself. A chunk is sized to take about DYNAMIC_CHUNK_TIME at
+ * the per-wire time observed so far, and shrinks as the iteration drains so the
+ * ranks finish together. */
+
+#define DYNAMIC_CHUNK_TIME 2e-3
+#define DYNAMIC_MIN_CHUNK 4
+
+struct WorkCounter {
+    MPI_Win win;
+    int *next; // one counter per iteration, exposed by the root
+};
+
+static WorkCounter make_work_counter(int procID, int num_of_iters) {
+    const int root = 0;
+    WorkCounter counter;
+    MPI_Aint size = procID == root ? num_of_iters * sizeof(int) : 0;
+    MPI_Win_allocate(size, sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &counter.next, &counter.win);
+    MPI_Win_lock_all(0, counter.win);
+    if (procID == root) {
+        memset(counter.next, 0, size);
+        MPI_Win_sync(counter.win);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    return counter;
+}
+
+static void free_work_counter(WorkCounter &counter) {
+    MPI_Win_unlock_all(counter.win);
+    MPI_Win_free(&counter.win);
+}
+
+// Returns the first wire of the next chunk of the iteration
+static int take_chunk(WorkCounter &counter, int iter_id, int chunk) {
+    const int root = 0;
+    int begin;
+    track(sizeof(int), sizeof(int), [&] {
+        MPI_Fetch_and_op(&chunk, &begin, MPI_INT, root, iter_id, MPI_SUM, counter.win);
+        MPI_Win_flush(root, counter.win);
+    });
+    return begin;
+}
+
+static int chunk_size(int nproc, int remaining, int wires_done, double busy_time) {
+    int chunk = remaining / (2 * nproc);
+    if (wires_done > 0 && busy_time > 0)
+        chunk = std::min(chunk, (int)(DYNAMIC_CHUNK_TIME * wires_done / busy_time));
+    else
+        chunk = std::min(chunk, DYNAMIC_MIN_CHUNK);
+    return std::max(chunk, DYNAMIC_MIN_CHUNK);
+}
+
+// Routes every iteration with wires pulled from the shared counter, and
+// exchanges costs and the routes each rank produced at the end of it
+static void route_dynamic(int procID, int nproc, Options options, Data data, cost_t *costs, cost_t *new_costs, CostExchange &exchange, Route *routes) {
+    const int root = 0;
+    int num_of_wires = data.num_of_wires;
+    WorkCounter counter = make_work_counter(procID, options.SA_iters);
+
+    std::vector<int> local_ids, all_ids(num_of_wires), id_counts(nproc), id_displs(nproc);
+    std::vector<Route> local_routes, all_routes(num_of_wires);
+    std::vector<int> route_counts(nproc), route_displs(nproc);
+    local_ids.reserve(num_of_wires);
+    local_routes.reserve(num_of_wires);
+    int wires_done = 0, num_of_chunks = 0;
+    double busy_time = 0;
+
+    for (int iter_id = 0; iter_id != options.SA_iters; ++iter_id) {
+        local_ids.clear();
+        // wires claimed by all ranks as of this rank's last fetch, which
+        // sizes the next chunk from the progress of the whole iteration
+        int claimed = 0;
+        while (true) {
+            int chunk = chunk_size(nproc, num_of_wires - claimed, wires_done, busy_time);
+            int begin = take_chunk(counter, iter_id, chunk);
+            if (begin >= num_of_wires)
+                break;
+            claimed = begin + chunk;
+            int end = std::min(claimed, num_of_wires);
+
+            double chunk_start = MPI_Wtime();
+            for (int wire_id = begin; wire_id != end; ++wire_id) {
+                route_wire(data, new_costs, routes, wire_id, options);
+                local_ids.push_back(wire_id);
+            }
+            busy_time += MPI_Wtime() - chunk_start;
+            wires_done += end - begin;
+            ++num_of_chunks;
+        }
+
+        synchronize_costs(costs, new_costs, exchange);
+
+        // Every rank needs the routes of every wire to rip them up later
+        enter_phase(PHASE_SYNC);
+        int num_of_local = local_ids.size();
+        track(sizeof(int), nproc * sizeof(int), [&] {
+            MPI_Allgather(&num_of_local, 1, MPI_INT, id_counts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+        });
+        for (int i = 0; i != nproc; ++i) {
+            id_displs[i] = i == 0 ? 0 : id_displs[i - 1] + id_counts[i - 1];
+            route_counts[i] = id_counts[i] * sizeof(Route);
+            route_displs[i] = id_displs[i] * sizeof(Route);
+        }
+        local_routes.clear();
+        for (int wire_id : local_ids)
+            local_routes.push_back(routes[wire_id]);
+        track(num_of_local * (sizeof(int) + sizeof(Route)), num_of_wires * (sizeof(int) + sizeof(Route)), [&] {
+            MPI_Allgatherv(local_ids.data(), num_of_local, MPI_INT, all_ids.data(), id_counts.data(), id_displs.data(), MPI_INT, MPI_COMM_WORLD);
+            MPI_Allgatherv(local_routes.data(), num_of_local * sizeof(Route), MPI_BYTE, all_routes.data(), route_counts.data(), route_displs.data(), MPI_BYTE, MPI_COMM_WORLD);
+        });
+        for (int i = 0; i != num_of_wires; ++i)
+            routes[all_ids[i]] = all_routes[i];
+        enter_phase(PHASE_ROUTE);
+    }
+
+    free_work_counter(counter);
+
+    double busy_max = busy_time, busy_sum = busy_time;
+    int chunks_sum = num_of_chunks;
+    MPI_Reduce(procID == root ? MPI_IN_PLACE : &busy_max, &busy_max, 1, MPI_DOUBLE, MPI_MAX, root, MPI_COMM_WORLD);
+    MPI_Reduce(procID == root ? MPI_IN_PLACE : &busy_sum, &busy_sum, 1, MPI_DOUBLE, MPI_SUM, root, MPI_COMM_WORLD);
+    MPI_Reduce(procID == root ? MPI_IN_PLACE : &chunks_sum, &chunks_sum, 1, MPI_INT, MPI_SUM, root, MPI_COMM_WORLD);
+    if (procID == root) {
+        printf("Chunks Taken: \t\t\t\t[%d].\n", chunks_sum);
+        printf("Busy Time Max/Avg: \t\t\t[%lf/%lf].\n", busy_max, busy_sum / nproc);
+    }
+}
+
+/* One-sided mode: the grid is split into row bands, each exposed by its owner
+ * in an RMA window. A rank routing a wire reads the rows of the wire's bounding
+ * box with MPI_Get, reroutes on that copy, and pushes the -1 / +1 changes back
+ * with MPI_Accumulate. All accesses stay within one lock_all epoch, so no rank
+ * waits for another until the end of the annealing. */
+
+struct BandGrid {
+    MPI_Win win;
+    cost_t *band; // rows [row_begin[rank], row_begin[rank + 1]) of this rank
+    std::vector<int> row_begin;
+};
+
+static BandGrid make_band_grid(int procID, int nproc, int dim_x, int dim_y, const cost_t *costs) {
+    BandGrid grid;
+    grid.row_begin.resize(nproc + 1);
+    for (int rank = 0; rank <= nproc; ++rank)
+        grid.row_begin[rank] = (int)((int64_t)dim_y * rank / nproc);
+    int num_of_rows = grid.row_begin[procID + 1] - grid.row_begin[procID];
+    MPI_Win_allocate((MPI_Aint)num_of_rows * dim_x * sizeof(cost_t), sizeof(cost_t), MPI_INFO_NULL, MPI_COMM_WORLD, &grid.band, &grid.win);
+    MPI_Win_lock_all(0, grid.win);
+    memcpy(grid.band, costs + (size_t)grid.row_begin[procID] * dim_x, (size_t)num_of_rows * dim_x * sizeof(cost_t));
+    MPI_Win_sync(grid.win);
+    MPI_Barrier(MPI_COMM_WORLD);
+    return grid;
+}
+
+// Gets (or accumulates, when delta) rows [y0, y1) from / to their owners
+static void transfer_rows(BandGrid &grid, int dim_x, int y0, int y1, cost_t *rows, bool delta) {
+    int rank = std::upper_bound(grid.row_begin.begin(), grid.row_begin.end(), y0) - grid.row_begin.begin() - 1;
+    for (int y = y0; y < y1; ++rank) {
+        int end = std::min(y1, grid.row_begin[rank + 1]);
+        if (end == y)
+            continue;
+        int count = (end - y) * dim_x;
+        MPI_Aint disp = (MPI_Aint)(y - grid.row_begin[rank]) * dim_x;
+        cost_t *buf = rows + (size_t)(y - y0) * dim_x;
+        track(delta ? count * sizeof(int) : 0, delta ? 0 : count * sizeof(int), [&] {
+            if (delta)
+                MPI_Accumulate(buf, count, MPI_INT, rank, disp, count, MPI_INT, MPI_SUM, grid.win);
+            else
+                MPI_Get(buf, count, MPI_INT, rank, disp, count, MPI_INT, grid.win);
+            MPI_Win_flush(rank, grid.win);
+        });
+        y = end;
+    }
+}
+
+// Routes the local wires for every iteration, then assembles the grid
+static void route_rma(int procID, int nproc, Options options, Data data, int dim_y, cost_t *costs, Route *routes, const int *local_wires, int num_of_local_wires) {
+    const int root = 0;
+    int dim_x = data.dim_x;
+    BandGrid grid = make_band_grid(procID, nproc, dim_x, dim_y, costs);
+    std::vector<cost_t> rows, delta;
+    double transfer_time = 0;
+
+    // Sized for the tallest local wire, so that no iteration allocates
+    int max_rows = 0;
+    for (int i = 0; i != num_of_local_wires; ++i)
+        max_rows = std::max(max_rows, abs(data.wires[local_wires[i]].end.y - data.wires[local_wires[i]].start.y) + 1);
+    rows.reserve((size_t)max_rows * dim_x);
+    delta.reserve((size_t)max_rows * dim_x);
+
+    for (int iter_id = 0; iter_id != options.SA_iters; ++iter_id) {
+        for (int i = 0; i != num_of_local_wires; ++i) {
+            int wire_id = local_wires[i];
+            Wire wire = data.wires[wire_id];
+            int y0 = std::min(wire.start.y, wire.end.y), y1 = std::max(wire.start.y, wire.end.y) + 1;
+            rows.resize((size_t)(y1 - y0) * dim_x);
+            delta.assign(rows.size(), 0);
+
+            double transfer_start = MPI_Wtime();
+            transfer_rows(grid, dim_x, y0, y1, rows.data(), false);
+            transfer_time += MPI_Wtime() - transfer_start;
+
+            // Every route of a wire stays in its bounding box
+            Route local_routes[1] = {shift_route(routes[wire_id], 0, -y0)};
+            walk_route<WALK_REMOVE>(dim_x, delta.data(), local_routes[0]);
+            Data local_data = {dim_x, 1, &local_routes[0].wire};
+            route_wire(local_data, rows.data(), local_routes, 0, options);
+            walk_route<WALK_ADD>(dim_x, delta.data(), local_routes[0]);
+            routes[wire_id] = shift_route(local_routes[0], 0, y0);
+
+            transfer_start = MPI_Wtime();
+            transfer_rows(grid, dim_x, y0, y1, delta.data(), true);
+            transfer_time += MPI_Wtime() - transfer_start;
+        }
+    }
+
+    // The first wait for another rank
+    enter_phase(PHASE_SYNC);
+    MPI_Win_sync(grid.win);
+    track(0, 0, [&] { MPI_Barrier(MPI_COMM_WORLD); });
+    MPI_Win_sync(grid.win);
+
+    std::vector<int> counts(nproc), displs(nproc);
+    for (int rank = 0; rank != nproc; ++rank) {
+        displs[rank] = grid.row_begin[rank] * dim_x;
+        counts[rank] = grid.row_begin[rank + 1] * dim_x - displs[rank];
+    }
+    track(counts[procID] * sizeof(int), dim_x * dim_y * sizeof(int), [&] {
+        MPI_Allgatherv(grid.band, counts[procID], MPI_INT, costs, counts.data(), displs.data(), MPI_INT, MPI_COMM_WORLD);
+    });
+    enter_phase(PHASE_ROUTE);
+    MPI_Win_unlock_all(grid.win);
+    MPI_Win_free(&grid.win);
+
+    double max_transfer_time = transfer_time;
+    MPI_Reduce(procID == root ? MPI_IN_PLACE : &max_transfer_time, &max_transfer_time, 1, MPI_DOUBLE, MPI_MAX, root, MPI_COMM_WORLD);
+    if (procID == root)
+        printf("RMA Transfer Time (max): \t\t[%lf].\n", max_transfer_time);
+}
 
 // Perform computation, including reading/writing output files
-void compute(int procID, int nproc, char *inputFilename, double SA_prob, int SA_iters) {
+void compute(int procID, int nproc, const char *inputFilename, Options options) {
+    int SA_iters = options.SA_iters;
+
     // TODO Implement code here
     // TODO Decide which processors should be reading/writing files
 
     srand(time(nullptr));
+    phase_start = MPI_Wtime();
 
     const int root = 0; // Set the rank 0 process as the root process
 
     int dim_x, dim_y, num_of_wires;
 
-    // Initialize inputs
-    std::ifstream input_file;
-    if (procID == root) {
-        input_file.open(inputFilename);
-        if (!input_file.is_open()) {
-            printf("Unable to open file: %s.\n", inputFilename);
+    // Initialize inputs: every rank loads a slice of the wires and draws their
+    // initial routes, then the slices are shared
+    std::vector<Wire> slice;
+    int wire_begin = 0;
+    if (is_binary_netlist(inputFilename)) {
+        int header[NETLIST_HEADER_INTS];
+        if (!read_netlist_slice(inputFilename, header, nproc, procID, slice, wire_begin)) {
+            if (procID == root)
+                printf("Unable to read netlist: %s.\n", inputFilename);
             return;
         }
+        dim_x = header[0], dim_y = header[1], num_of_wires = header[2];
+    } else {
+        // Text netlists can only be parsed from the start, so the root reads
+        // them and scatters the slices
+        std::ifstream input_file;
+        int header[NETLIST_HEADER_INTS] = {-1, 0, 0};
+        if (procID == root) {
+            input_file.open(inputFilename);
+            if (input_file.is_open())
+                input_file >> header[0] >> header[1] >> header[2];
+        }
+        MPI_Bcast(header, NETLIST_HEADER_INTS, MPI_INT, root, MPI_COMM_WORLD);
+        if (header[0] < 0) {
+            if (procID == root)
+                printf("Unable to open file: %s.\n", inputFilename);
+            return;
+        }
+        dim_x = header[0], dim_y = header[1], num_of_wires = header[2];
 
-        input_file >> dim_x >> dim_y >> num_of_wires;
+        std::vector<Wire> all_wires;
+        std::vector<int> counts(nproc), displs(nproc);
+        for (int i = 0; i != nproc; ++i) {
+            displs[i] = (int)((int64_t)num_of_wires * i / nproc) * sizeof(Wire);
+            counts[i] = (int)((int64_t)num_of_wires * (i + 1) / nproc) * sizeof(Wire) - displs[i];
+        }
+        if (procID == root) {
+            for (int i = 0; i < num_of_wires; ++i) {
+                int start_x, start_y, end_x, end_y;
+                input_file >> start_x >> start_y >> end_x >> end_y;
+                all_wires.push_back({{start_x, start_y}, {end_x, end_y}, i});
+            }
+            input_file.close();
+        }
+        wire_begin = displs[procID] / sizeof(Wire);
+        slice.resize(counts[procID] / sizeof(Wire));
+        track(procID == root ? num_of_wires * sizeof(Wire) : 0, counts[procID], [&] {
+            MPI_Scatterv(all_wires.data(), counts.data(), displs.data(), MPI_BYTE, slice.data(), counts[procID], MPI_BYTE, root, MPI_COMM_WORLD);
+        });
     }
-    MPI_Bcast(&dim_x, 1, MPI_INT, root, MPI_COMM_WORLD);
-    MPI_Bcast(&dim_y, 1, MPI_INT, root, MPI_COMM_WORLD);
-    MPI_Bcast(&num_of_wires, 1, MPI_INT, root, MPI_COMM_WORLD);
 
     Wire *wires = (Wire *)calloc(num_of_wires, sizeof(Wire));
     Route *routes = (Route *)calloc(num_of_wires, sizeof(Route));
-    cost_t *costs = (cost_t *)calloc(dim_x * dim_y, sizeof(cost_t));
+    // Only the replicated mode keeps the whole board on every rank
+    cost_t *costs = nullptr;
     const size_t costs_size = dim_x * dim_y * sizeof(cost_t);
 
     Data data = {dim_x, num_of_wires, wires};
     // Result result = {costs, prev_routes};
 
-    int work_per_proc[128];
-    uint64_t workload_per_proc[128];
+    std::vector<Route> slice_routes;
+    for (const Wire &wire : slice)
+        slice_routes.push_back(generate_random_route(wire));
 
-    if (procID == root) {
-        uint64_t total_computation_cost = 0;
-        for (int i = 0; i < num_of_wires; ++i) {
-            int start_x, start_y, end_x, end_y;
-            input_file >> start_x >> start_y >> end_x >> end_y;
-            wires[i] = {{start_x, start_y}, {end_x, end_y}, i};
-            total_computation_cost += wires[i].computation_cost;
+    // Every mode needs all wires (partitioning, rip-up of any route) on every rank
+    enter_phase(PHASE_BROADCAST);
+    {
+        std::vector<int> counts(nproc), displs(nproc);
+        int slice_size = slice.size();
+        MPI_Allgather(&slice_size, 1, MPI_INT, counts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+        for (int i = 0; i != nproc; ++i)
+            displs[i] = i == 0 ? 0 : displs[i - 1] + counts[i - 1];
+        for (int i = 0; i != nproc; ++i) {
+            counts[i] *= sizeof(Wire);
+            displs[i] *= sizeof(Wire);
         }
-        input_file.close();
-
-        routes = (Route *)calloc(num_of_wires, sizeof(Route));
-        for (int wire_id = 0; wire_id < num_of_wires; wire_id++) {
-            routes[wire_id] = generate_random_route(wires[wire_id]);
+        track(slice.size() * sizeof(Wire), num_of_wires * sizeof(Wire), [&] {
+            MPI_Allgatherv(slice.data(), slice.size() * sizeof(Wire), MPI_BYTE, wires, counts.data(), displs.data(), MPI_BYTE, MPI_COMM_WORLD);
+        });
+        for (int i = 0; i != nproc; ++i) {
+            counts[i] = counts[i] / sizeof(Wire) * sizeof(Route);
+            displs[i] = displs[i] / sizeof(Wire) * sizeof(Route);
         }
+        track(slice_routes.size() * sizeof(Route), num_of_wires * sizeof(Route), [&] {
+            MPI_Allgatherv(slice_routes.data(), slice_routes.size() * sizeof(Route), MPI_BYTE, routes, counts.data(), displs.data(), MPI_BYTE, MPI_COMM_WORLD);
+        });
+    }
+
+    if (options.decomposed) {
+        compute_decomposed(procID, nproc, inputFilename, options, data, dim_y, routes);
+        return;
+    }
 
+    NodeGrids node_grids;
+    cost_t *new_costs;
+    if (options.shared) {
+        node_grids = make_node_grids(procID, dim_x * dim_y);
+        costs = node_grids.costs;
+        new_costs = node_grids.new_costs;
+        if (node_grids.leader_comm != MPI_COMM_NULL)
+            memset(costs, 0, costs_size);
+    } else {
         costs = (cost_t *)calloc(dim_x * dim_y, sizeof(cost_t));
-        data = {dim_x, num_of_wires, wires};
-        // result = {costs, routes};
-        auto total_metrics = walk_all_routes(data, costs, routes, 1);
-        // std::cout << total_metrics << std::endl;
-        // std::cout << total_computation_cost << std::endl;
-
-        // load-balancing
-        uint64_t computation_per_proc = total_computation_cost / nproc;
-        // std::cout << computation_per_proc << std::endl;
-        uint64_t accumulated_computation = 0;
-        int proc_id = 0;
-        // std::cout << nproc << std::endl;
-        for (int wire_id = 0; wire_id < num_of_wires; ++wire_id) {
-            accumulated_computation += wires[wire_id].computation_cost;
-
-            // last thread
-            if (wire_id == num_of_wires - 1) {
-                work_per_proc[proc_id] = wire_id + 1;
-                workload_per_proc[proc_id] = accumulated_computation;
-            } else if (accumulated_computation >= computation_per_proc * 0.999 && proc_id != nproc - 1) {
-                assert(proc_id < nproc);
-                work_per_proc[proc_id] = wire_id + 1;
-                workload_per_proc[proc_id] = accumulated_computation;
-                proc_id += 1;
-                accumulated_computation = 0;
-            }
+        new_costs = (cost_t *)calloc(dim_x * dim_y, sizeof(cost_t));
+    }
+    // Initial grid: the routes of every slice summed over all ranks
+    if (!options.shared) {
+        for (size_t i = 0; i != slice_routes.size(); ++i)
+            walk_a_route(data, costs, slice_routes[i], 1);
+        track(costs_size, costs_size, [&] { MPI_Allreduce(MPI_IN_PLACE, costs, dim_x * dim_y, MPI_INT, MPI_SUM, MPI_COMM_WORLD); });
+        memcpy(new_costs, costs, costs_size);
+    } else {
+        node_barrier(node_grids);
+        for (size_t i = 0; i != slice_routes.size(); ++i)
+            walk_a_route_atomic(data, costs, slice_routes[i], 1);
+        node_barrier(node_grids);
+        if (node_grids.leader_comm != MPI_COMM_NULL) {
+            track(costs_size, costs_size, [&] { MPI_Allreduce(MPI_IN_PLACE, costs, dim_x * dim_y, MPI_INT, MPI_SUM, node_grids.leader_comm); });
+            memcpy(new_costs, costs, costs_size);
         }
+        node_barrier(node_grids);
+    }
 
-        // for (int i = 0; i != nproc; ++i) {
-        //     std::cout << i << ": " << work_per_proc[i] << "(" << (double)workload_per_proc[i] / (double)computation_per_proc << ")\n";
-        // }
+    // load-balancing
+    Partition partition = make_partition(wires, num_of_wires, nproc);
+    if (procID == root) {
+        uint64_t max_workload = *std::max_element(partition.workload.begin(), partition.workload.end());
+        uint64_t total_workload = 0;
+        for (uint64_t workload : partition.workload)
+            total_workload += workload;
+        // work of every rank, as the sum of computation_cost of its wires
+        for (int rank = 0; rank != nproc; ++rank) {
+            double ratio = total_workload ? (double)partition.workload[rank] * nproc / total_workload : 1.0;
+            printf("Partition Rank %d (wires, work, work/avg): \t[%d, %llu, %lf].\n", rank,
+                   partition.rank_begin[rank + 1] - partition.rank_begin[rank], (unsigned long long)partition.workload[rank], ratio);
+        }
+        printf("Partition Imbalance (max/avg): \t\t[%lf].\n", total_workload ? (double)max_workload * nproc / total_workload : 1.0);
     }
-    MPI_Bcast(wires, num_of_wires * sizeof(Wire), MPI_BYTE, root, MPI_COMM_WORLD);
-    MPI_Bcast(routes, num_of_wires * sizeof(Route), MPI_BYTE, root, MPI_COMM_WORLD);
-    // std::cout << proc_info() << wires[1111].computation_cost << " " << wires[100].computation_cost << " " << num_of_wires << std::endl;
-    MPI_Bcast(costs, costs_size, MPI_BYTE, root, MPI_COMM_WORLD);
-    MPI_Bcast(work_per_proc, nproc, MPI_INT, root, MPI_COMM_WORLD);
 
-    cost_t *new_costs = (cost_t *)calloc(dim_x * dim_y, sizeof(cost_t));
-    memcpy(new_costs, costs, costs_size);
+    CostExchange exchange = make_cost_exchange(options.shared ? node_grids.leader_comm : MPI_COMM_WORLD, dim_x * dim_y);
+    if (options.shared)
+        exchange.node = &node_grids;
 
-    int wire_id_begin = (procID == 0 ? 0 : work_per_proc[procID - 1]);
-    int wire_id_end = work_per_proc[procID];
+    // Overlapped synchronization: working copy at the last post, and two exchange slots
+    cost_t *mark = nullptr;
+    PendingExchange pending[2];
+    OverlapStats overlap_stats;
+    int sync_id = 0;
+    if (options.overlap) {
+        mark = (cost_t *)calloc(dim_x * dim_y, sizeof(cost_t));
+        memcpy(mark, new_costs, costs_size);
+        for (PendingExchange &slot : pending) {
+            // Sized up front, so that advancing an exchange between wires never allocates
+            slot.own.resize(dim_x * dim_y);
+            slot.global.resize(dim_x * dim_y);
+            slot.received.reserve(SPARSE_EXCHANGE_LIMIT * dim_x * dim_y);
+            slot.counts.resize(nproc);
+            slot.displs.resize(nproc);
+        }
+    }
 
-    // std::deque<Wire> work_queue;
-    // for (int wire_id = wire_id_begin; wire_id < wire_id_end; ++wire_id) {
-    //     work_queue.push_back(wires[wire_id]);
-    // }
-    // std::cout << proc_info() << wire_id_begin << " " << wire_id_end << std::endl;
+    const int *local_wires = partition.order.data() + partition.rank_begin[procID];
+    int num_of_local_wires = partition.rank_begin[procID + 1] - partition.rank_begin[procID];
 
-    for (int iter_id = 0; iter_id != SA_iters; ++iter_id) {
-        for (int wire_id = wire_id_begin; wire_id < wire_id_end; ++wire_id) {
-            Wire wire = wires[wire_id];
-            Route prev_route = routes[wire_id];
-            prev_route.metrics = walk_a_route(data, new_costs, prev_route, -1);
+    // Every rank has to join every synchronization, so all of them split their
+    // slice into as many batches as the largest slice needs
+    int num_of_batches = 1;
+    if (options.sync_interval > 0) {
+        int max_wires_per_proc = num_of_local_wires;
+        MPI_Allreduce(MPI_IN_PLACE, &max_wires_per_proc, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+        num_of_batches = std::max(1, (max_wires_per_proc + options.sync_interval - 1) / options.sync_interval);
+    }
 
-            if (is_random_route(SA_prob)) {
-                Route new_route = generate_random_route(wire);
-                walk_a_route(data, new_costs, new_route, 1);
-                routes[wire_id] = new_route;
-                continue;
-            }
+    double compute_start = MPI_Wtime();
+    enter_phase(PHASE_ROUTE);
+
+    if (options.dynamic) {
+        route_dynamic(procID, nproc, options, data, costs, new_costs, exchange, routes);
+    } else if (options.rma) {
+        route_rma(procID, nproc, options, data, dim_y, costs, routes, local_wires, num_of_local_wires);
+    } else {
+        for (int iter_id = 0; iter_id != SA_iters; ++iter_id) {
+            for (int batch_id = 0; batch_id != num_of_batches; ++batch_id) {
+                int batch_begin = (int)((int64_t)num_of_local_wires * batch_id / num_of_batches);
+                int batch_end = (int)((int64_t)num_of_local_wires * (batch_id + 1) / num_of_batches);
 
-            std::vector<Route> all_routes_for_one_wire = generate_routes(wire);
-            Route best_route = prev_route;
-            for (int route_id = 0; route_id != all_routes_for_one_wire.size(); ++route_id) {
-                Route new_route = all_routes_for_one_wire[route_id];
-                new_route.metrics = walk_a_route(data, new_costs, new_route, 0);
-                if (new_route.metrics < best_route.metrics) {
-                    best_route = new_route;
+                for (int i = batch_begin; i < batch_end; ++i) {
+                    route_wire(data, new_costs, routes, local_wires[i], options);
+                    if (options.overlap)
+                        progress_exchange(pending[(sync_id + 1) % 2], dim_x * dim_y);
                 }
+
+                if (options.overlap)
+                    overlap_costs(pending, sync_id++, procID, costs, new_costs, mark, dim_x * dim_y, overlap_stats);
+                else
+                    synchronize_costs(costs, new_costs, exchange);
             }
-            best_route.metrics = walk_a_route(data, new_costs, best_route, 1);
-            routes[wire_id] = best_route;
         }
     }
+    if (options.overlap) {
+        for (int i = 0; i != 2; ++i)
+            complete_exchange(pending[(sync_id + 1 + i) % 2], procID, costs, new_costs, mark, dim_x * dim_y, overlap_stats);
+    }
 
-    Metrics metrics_all_routes = walk_all_routes(data, new_costs, routes, 0);
-    std::cout << metrics_all_routes << std::endl;
+    double compute_time = MPI_Wtime() - compute_start;
 
-    // write to file
+    // Metrics of the local routes on the consistent grid, reduced over all ranks
+    Metrics local_metrics;
+    for (int i = 0; i != num_of_local_wires; ++i)
+        local_metrics.update(walk_route<WALK_SCORE>(dim_x, costs, routes[local_wires[i]]));
+    MPI_Op metrics_op;
+    MPI_Op_create(combine_metrics, 1, &metrics_op);
+    Metrics metrics_all_routes;
+    MPI_Reduce(&local_metrics, &metrics_all_routes, 1, MPI_2INT, metrics_op, root, MPI_COMM_WORLD);
+    MPI_Op_free(&metrics_op);
+    double overlap_times[2] = {overlap_stats.total_time, overlap_stats.exposed_time};
+    if (options.overlap)
+        MPI_Reduce(procID == root ? MPI_IN_PLACE : overlap_times, overlap_times, 2, MPI_DOUBLE, MPI_SUM, root, MPI_COMM_WORLD);
     if (procID == root) {
-        std::string filename = std::string(basename(inputFilename));
-        std::string name = filename.substr(0, filename.size() - 4);
-
-        // Write costs
-        std::ofstream costs_file("cost_" + name + "_" + std::to_string(nproc) + ".txt");
-        costs_file << dim_x << " " << dim_y << "\n";
-        for (int i = 0; i != dim_x * dim_y; ++i) {
-            costs_file << (uint32_t)new_costs[i] << ((i % dim_y == dim_y - 1) ? "\n" : " ");
-        }
-        costs_file.close();
-
-        // Write wires
-        std::ofstream wires_file("output_" + name + "_" + std::to_string(nproc) + ".txt");
-        wires_file << dim_x << " " << dim_y << "\n"
-                   << num_of_wires << "\n";
-        for (int i = 0; i != num_of_wires; ++i)
-            wires_file << routes[i] << "\n";
-        wires_file.close();
+        printf("Computation Time: \t\t\t[%lf].\n", compute_time);
+        if (options.overlap && overlap_times[0] > 0)
+            printf("Hidden Communication: \t\t\t[%.1lf%%].\n", 100 * (1 - overlap_times[1] / overlap_times[0]));
+        std::cout << metrics_all_routes << std::endl;
     }
+
+    // write to file
+    enter_phase(PHASE_WRITE);
+    write_outputs_collective(inputFilename, procID, nproc, data, dim_y, costs, routes, local_wires, num_of_local_wires);
+    if (options.shared)
+        free_node_grids(node_grids);
 }
@@ -5,12 +5,31 @@
 #include "wireroute.h"
 
 #include <assert.h>
+#include <atomic>
 #include <chrono>
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#ifdef _OPENMP
 #include <omp.h>
+#endif
+
+/* The wireroute-serial and wireroute-threads targets build this frontend
+ * without OpenMP. Its parallel loops then run serially, the omp and optimistic
+ * modes are rejected, and -m defaults to the backend of the target. */
+#ifndef WIREROUTE_DEFAULT_MODE
+#define WIREROUTE_DEFAULT_MODE "omp"
+#endif
 
 static int _argc;
 static const char **_argv;
@@ -45,6 +64,16 @@ static void show_help(const char *program_path) {
     printf("\t-n <num_of_threads> (required)\n");
     printf("\t-p <SA_prob>\n");
     printf("\t-i <SA_iters>\n");
+    printf("\t-m <mode> (omp, seq, optimistic or thread)\n");
+    printf("\t-h <hotspot_fraction> (fraction of tiles re-routed between full sweeps, 0 to disable)\n");
+    printf("\t-s <full_sweep_period>\n");
+    printf("\t-c <capacity> (negotiated congestion: wires a cell carries before it gains history cost, 0 to disable; omp and seq modes, dense grid)\n");
+    printf("\t-k <cached_candidates_per_wire> (0 to disable, omp and seq modes only)\n");
+    printf("\t-e <evaluator> (sweep or walk, omp and seq modes only)\n");
+    printf("\t-O <objective> (max-sum, weighted or overflow)\n");
+    printf("\t-g <grid> (dense or sparse, allocating cost tiles on first write)\n");
+    printf("\t-x <isa> (default, sse4.2, avx2 or avx512; detected from the CPU when omitted)\n");
+    printf("\t-d <socket_path> (serve resident boards on a Unix socket, - for stdin)\n");
 }
 
 int main(int argc, const char *argv[]) {
@@ -62,157 +91,413 @@ int main(int argc, const char *argv[]) {
     int num_of_threads = get_option_int("-n", 1);
     double SA_prob = get_option_float("-p", 0.1f);
     int SA_iters = get_option_int("-i", 5);
+    std::string mode = get_option_string("-m", WIREROUTE_DEFAULT_MODE);
+    double hotspot_fraction = get_option_float("-h", 0.f);
+    int full_sweep_period = get_option_int("-s", 4);
+    int cache_k = get_option_int("-k", 0);
+    int capacity = get_option_int("-c", 0);
+    std::string evaluator = get_option_string("-e", "sweep");
+    const char *socket_path = get_option_string("-d", NULL);
+    std::string objective_name = get_option_string("-O", "max-sum");
+    std::string grid = get_option_string("-g", "dense");
+    const char *isa_override = get_option_string("-x", NULL);
 
     int error = 0;
 
-    if (input_filename == NULL) {
+    if (input_filename == NULL && socket_path == NULL) {
         printf("Error: You need to specify -f.\n");
         error = 1;
     }
 
+    if (mode != "omp" && mode != "seq" && mode != "optimistic" && mode != "thread") {
+        printf("Error: Unknown mode %s.\n", mode.c_str());
+        error = 1;
+    }
+
+#ifndef _OPENMP
+    if (mode == "omp" || mode == "optimistic") {
+        printf("Error: Mode %s needs a build with OpenMP.\n", mode.c_str());
+        error = 1;
+    }
+#endif
+
+    ObjectiveKind objective = OBJECTIVE_MAX_SUM;
+    if (!parse_objective(objective_name, &objective)) {
+        printf("Error: Unknown objective %s.\n", objective_name.c_str());
+        error = 1;
+    }
+
+    Isa isa = active_isa();
+    if (isa_override && (!parse_isa(isa_override, &isa) || !isa_supported(isa))) {
+        printf("Error: Instruction set %s is unknown or unsupported by this CPU.\n", isa_override);
+        error = 1;
+    }
+    active_isa() = isa;
+
+    if (grid != "dense" && grid != "sparse") {
+        printf("Error: Unknown grid %s.\n", grid.c_str());
+        error = 1;
+    }
+
+    if (evaluator != "sweep" && evaluator != "walk") {
+        printf("Error: Unknown evaluator %s.\n", evaluator.c_str());
+        error = 1;
+    }
+
+    if (full_sweep_period < 1) {
+        printf("Error: -s must be positive.\n");
+        error = 1;
+    }
+
+    if (capacity < 0 || (capacity > 0 && (mode == "optimistic" || mode == "thread" || grid == "sparse"))) {
+        printf("Error: -c must be non-negative and needs omp or seq mode on a dense grid.\n");
+        error = 1;
+    }
+
     if (error) {
         show_help(argv[0]);
         return 1;
     }
 
+    RouterOptions options = {
+        num_of_threads,
+        SA_prob,
+        mode,
+        hotspot_fraction,
+        full_sweep_period,
+        cache_k,
+        evaluator == "sweep",
+        objective,
+        grid == "sparse",
+        capacity};
+
+    srand(time(nullptr));
+#ifdef _OPENMP
+    omp_set_num_threads(num_of_threads);
+    omp_set_nested(1);
+#endif
+
+    if (socket_path)
+        return serve_boards(socket_path, options);
+
     printf("Number of threads: \t\t\t[%d]\n", num_of_threads);
+    printf("Instruction set: \t\t\t[%s]\n", isa_name(active_isa()));
     // printf("Probability parameter for simulated annealing: %lf.\n", SA_prob);
     // printf("Number of simulated annealing iterations: %d\n", SA_iters);
     // printf("Input file: %s\n", input_filename);
 
-    FILE *input = fopen(input_filename, "r");
-
-    if (!input) {
-        printf("Unable to open file: %s.\n", input_filename);
+    Router router(options);
+    if (!router.load(input_filename)) {
+        printf("Unable to load file: %s.\n", input_filename);
         return 1;
     }
 
+    init_time += duration_cast<dsec>(Clock::now() - init_start).count();
+    printf("Initialization Time: %lf.\n", init_time);
+
+    auto compute_start = Clock::now();
+    double compute_time = 0;
+
+    router.route(SA_iters);
+
+    compute_time += duration_cast<dsec>(Clock::now() - compute_start).count();
+    printf("Computation Time: \t\t\t[%lf].\n", compute_time);
+    RouterStats stats = router.stats();
+    if (mode == "optimistic" || mode == "thread") {
+        printf("Optimistic retries: \t\t\t[%ld].\n", stats.optimistic_retries);
+        printf("Forced commits: \t\t\t[%ld].\n", stats.forced_commits);
+    }
+    if (hotspot_fraction > 0 || capacity > 0)
+        printf("Re-routed wires: \t\t\t[%ld].\n", stats.rerouted_wires);
+    if (cache_k > 0 && mode != "optimistic" && mode != "thread")
+        printf("Rescored candidates: \t\t\t[%ld / %ld].\n", stats.scored_candidates, stats.total_candidates);
+    if (grid == "sparse")
+        printf("Allocated cost tiles: \t\t\t[%d / %d].\n", router.allocated_tiles(), router.num_of_tiles());
+
+    /* Write wires and costs to files */
+    // Print metrics to screen
+    std::cout << router.metrics() << std::endl;
+    router.export_results("output_" + std::to_string(num_of_threads) + ".txt", "wires.txt");
+
+    return 0;
+}
+
+/* The board keeps either a dense cost grid or a sparse one. These pick the
+ * walker once per route or line, never per cell. */
+
+template <WalkMode mode, class Objective = MaxThenSum>
+static inline Metrics walk_board_route(Data data, Result result, const Route &route) {
+    if (result.sparse)
+        return walk_route<mode, Objective>(*result.sparse, route);
+    return walk_route<mode, Objective>(data.dim_x, result.costs, route);
+}
+
+template <WalkAxis axis, WalkMode mode, class Objective = MaxThenSum>
+static inline Metrics walk_board_line(Data data, Result result, Point p1, Point p2) {
+    if (result.sparse)
+        return walk_line<axis, mode, Objective>(*result.sparse, p1, p2);
+    return walk_line<axis, mode, Objective>(data.dim_x, result.costs, p1, p2);
+}
+
+template <WalkMode mode>
+static inline Metrics walk_board_segment(Data data, Result result, Point p1, Point p2) {
+    if (p1.x == p2.x)
+        return walk_board_line<AXIS_Y, mode>(data, result, p1, p2);
+    return walk_board_line<AXIS_X, mode>(data, result, p1, p2);
+}
+
+static inline cost_t board_cost(Data data, Result result, int x, int y) {
+    return result.sparse ? sparse_at(*result.sparse, x, y) : result.costs[y * data.dim_x + x];
+}
+
+Router::Router(const RouterOptions &options) : options(options), data(), result(), grid(), regions(), cache(), totals(), iteration(0) {}
+
+Router::~Router() {
+    free(regions.versions);
+    free_sparse_grid(grid);
+}
+
+static bool wire_on_board(int dim_x, int dim_y, Point start, Point end) {
+    auto on_board = [&](Point p) { return p.x >= 0 && p.x < dim_x && p.y >= 0 && p.y < dim_y; };
+    return on_board(start) && on_board(end);
+}
+
+// Reads a netlist and lays every wire on a random route, replacing any board
+// loaded before. Fails, leaving the router untouched, on a malformed netlist.
+bool Router::load(const char *input_filename) {
+    FILE *input = fopen(input_filename, "r");
+    if (!input)
+        return false;
+
     int dim_x, dim_y;
     int num_of_wires;
 
-    fscanf(input, "%d %d\n", &dim_x, &dim_y);
-    fscanf(input, "%d\n", &num_of_wires);
-
-    srand(time(nullptr));
-    omp_set_num_threads(num_of_threads);
-    omp_set_nested(1);
+    if (fscanf(input, "%d %d\n", &dim_x, &dim_y) != 2 || fscanf(input, "%d\n", &num_of_wires) != 1 ||
+        dim_x <= 0 || dim_y <= 0 || num_of_wires < 0) {
+        fclose(input);
+        return false;
+    }
 
-    Wire *wires = (Wire *)calloc(num_of_wires, sizeof(Wire));
+    std::vector<Wire> loaded(num_of_wires);
     /* Read the grid dimenseon and wire information from file */
     for (int i = 0; i < num_of_wires; i++) {
-        fscanf(input, "%d %d %d %d\n", &wires[i].start.x, &wires[i].start.y, &wires[i].end.x, &wires[i].end.y);
+        Wire &wire = loaded[i];
+        if (fscanf(input, "%d %d %d %d\n", &wire.start.x, &wire.start.y, &wire.end.x, &wire.end.y) != 4 ||
+            !wire_on_board(dim_x, dim_y, wire.start, wire.end)) {
+            fclose(input);
+            return false;
+        }
+        wire.id = i;
     }
+    fclose(input);
+    wires.swap(loaded);
 
-    Data data = {
+    data = {
         dim_x, dim_y,
         num_of_wires,
-        wires,
-        num_of_threads,
-        SA_prob,
-        SA_iters};
+        wires.data(),
+        options.num_of_threads,
+        options.SA_prob,
+        0,
+        options.sweep_evaluator,
+        options.objective};
 
-    cost_t *costs = (cost_t *)calloc(dim_x * dim_y, sizeof(cost_t));
     /* Initialize cost matrix */
-    /* Initailize additional data structures needed in the algorithm */
-    Route *routes = (Route *)calloc(num_of_wires, sizeof(Route));
-
+    free_sparse_grid(grid);
+    if (options.sparse_grid) {
+        costs.clear();
+        grid = make_sparse_grid(dim_x, dim_y);
+    } else {
+        costs.assign((size_t)dim_x * dim_y, 0);
+    }
+    routes.resize(num_of_wires);
     for (int i = 0; i < num_of_wires; i++) {
-        routes[i] = generate_random_route(data, wires[i]);
+        routes[i] = generate_random_route(wires[i]);
     }
-    Result result = {costs, routes};
+    result = {costs.data(), routes.data(), options.sparse_grid ? &grid : nullptr, nullptr};
+    history.assign(options.capacity > 0 ? costs.size() : 0, 0);
     walk_all_routes(data, result, 1);
 
-    std::vector<std::vector<Route>> possible_routes = prepare_all_routes(data, result);
-    std::vector<Route> possible_routes_flatten = prepare_all_routes_flatten(data, result);
+    free(regions.versions);
+    regions = make_regions(data);
+    possible_routes = prepare_all_routes(data, result);
+    all_wire_ids.resize(num_of_wires);
+    for (int i = 0; i < num_of_wires; i++)
+        all_wire_ids[i] = i;
+    totals = RouterStats();
+    iteration = 0;
+    refresh();
+    return true;
+}
 
-    // std::cout << "Total routes: " << possible_routes.size() << std::endl;
-    // std::cout << "Sizes: ";
-    // for (auto routes : possible_routes) {
-    //     std::cout << routes.size() << " ";
-    // }
-    // std::cout << std::endl;
+// Re-points the views over the board and drops every cached candidate score
+void Router::refresh() {
+    data.num_of_wires = wires.size();
+    data.wires = wires.data();
+    result.routes = routes.data();
+    if (options.cache_k > 0)
+        cache = make_candidate_cache(data, options.cache_k);
+}
 
-    init_time += duration_cast<dsec>(Clock::now() - init_start).count();
-    printf("Initialization Time: %lf.\n", init_time);
+void Router::route(int iterations) {
+    long scored_candidates = cache.scored_candidates, total_candidates = cache.total_candidates;
+    data.SA_iters = iterations;
+    for (int i = 0; i < iterations; ++i, ++iteration) {
+        if (options.capacity > 0) {
+            // A pass with no wire left on an overused cell has converged
+            long rerouted = route_negotiated();
+            totals.rerouted_wires += rerouted;
+            if (rerouted == 0)
+                break;
+            continue;
+        }
 
-    auto compute_start = Clock::now();
-    double compute_time = 0;
+        // Between full sweeps only wires crossing the most congested tiles can
+        // lower the max cost, so only those are ripped up and re-routed
+        std::vector<int> hotspot_wire_ids;
+        bool full_sweep = options.hotspot_fraction <= 0 || iteration % options.full_sweep_period == 0;
+        if (!full_sweep) {
+            WireIndex index = build_wire_index(data, result);
+            hotspot_wire_ids = select_hotspot_wires(data, result, index, options.hotspot_fraction);
+        }
+        const std::vector<int> &wire_ids = full_sweep ? all_wire_ids : hotspot_wire_ids;
+        totals.rerouted_wires += wire_ids.size();
+
+        CandidateCache *candidate_cache = options.cache_k > 0 ? &cache : nullptr;
+        if (options.mode == "optimistic" || options.mode == "thread") {
+            OptimisticStats optimistic = options.mode == "optimistic"
+                                             ? wire_routing_optimistic(data, result, regions, possible_routes, wire_ids)
+                                             : wire_routing_threads(data, result, regions, possible_routes, wire_ids, options.num_of_threads);
+            totals.optimistic_retries += optimistic.retries;
+            totals.forced_commits += optimistic.forced_commits;
+        } else if (options.mode == "seq")
+            wire_routing_sequential(data, result, possible_routes, wire_ids, candidate_cache);
+        else
+            wire_routing(data, result, possible_routes, wire_ids, candidate_cache);
+    }
+    totals.scored_candidates += cache.scored_candidates - scored_candidates;
+    totals.total_candidates += cache.total_candidates - total_candidates;
+}
+
+// One pass of negotiated congestion. Candidates are scored on present plus
+// history costs, and every cell still overused after the pass grows its
+// history, so wires keep off cells that stay contested. Returns the number of
+// re-routed wires.
+long Router::route_negotiated() {
+    size_t num_of_cells = costs.size();
+    negotiated.resize(num_of_cells);
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < num_of_cells; ++i)
+        negotiated[i] = costs[i] + history[i];
+    result.negotiated = negotiated.data();
+
+    // history moved every score, so nothing cached before the pass holds
+    CandidateCache *candidate_cache = options.cache_k > 0 ? &cache : nullptr;
+    if (candidate_cache)
+        invalidate_candidate_cache(cache);
+    long rerouted = wire_routing_negotiated(data, result, possible_routes, candidate_cache, options.capacity, options.mode == "omp");
+    result.negotiated = nullptr;
+
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < num_of_cells; ++i)
+        if (costs[i] > options.capacity)
+            history[i] += HISTORY_COST;
+    return rerouted;
+}
+
+// Rips up the routes of moved wires and lays moved and added wires on random
+// routes. Nothing is applied unless every change stays on the board.
+bool Router::apply_changes(const std::vector<WireChange> &changes) {
+    for (const WireChange &change : changes)
+        if (change.wire_id < -1 || change.wire_id >= (int)wires.size() ||
+            !wire_on_board(data.dim_x, data.dim_y, change.start, change.end))
+            return false;
+
+    for (const WireChange &change : changes) {
+        int wire_id = change.wire_id;
+        if (wire_id == -1) {
+            wire_id = wires.size();
+            wires.push_back(Wire());
+            routes.push_back(Route());
+            possible_routes.emplace_back();
+            all_wire_ids.push_back(wire_id);
+        } else {
+            walk_a_route(data, result, routes[wire_id], -1);
+        }
+
+        Wire &wire = wires[wire_id];
+        wire.start = change.start;
+        wire.end = change.end;
+        wire.id = wire_id;
 
-    /**
-   * Implement the wire routing algorithm here
-   * Feel free to structure the algorithm into different functions
-   * Don't use global variables.
-   * Use OpenMP to parallelize the algorithm.
-   */
-    for (int i = 0; i != SA_iters; ++i) {
-        wire_routing(data, result, possible_routes);
-        // wire_routing_sequential(data, result, possible_routes);
-        // solve_all_metrics(data, result, possible_routes_flatten);
+        routes[wire_id] = generate_random_route(wire);
+        result.routes = routes.data();
+        walk_a_route(data, result, routes[wire_id], 1);
+
+        std::vector<Route> &candidates = possible_routes[wire_id];
+        candidates.clear();
+        for (int route_id = 0; route_id != num_of_candidates(wire); ++route_id)
+            candidates.push_back(candidate_route(wire, route_id));
     }
+    refresh();
+    return true;
+}
 
-    compute_time += duration_cast<dsec>(Clock::now() - compute_start).count();
-    printf("Computation Time: \t\t\t[%lf].\n", compute_time);
+int Router::allocated_tiles() const {
+    int allocated = 0;
+    for (int tile = 0; tile < grid.tiles_x * grid.tiles_y; ++tile)
+        allocated += grid.tiles[tile] != nullptr;
+    return allocated;
+}
 
-    /* Write wires and costs to files */
-    // Print metrics to screen
-    Metrics metrics_all_routes = walk_all_routes(data, result, 0);
-    std::cout << metrics_all_routes << std::endl;
+Metrics Router::metrics() const { return walk_all_routes(data, result, 0); }
+
+bool Router::export_results(const std::string &costs_filename, const std::string &wires_filename) const {
+    int dim_x = data.dim_x, dim_y = data.dim_y;
 
     // Write costs
-    std::ofstream costs_file("output_" + std::to_string(num_of_threads) + ".txt");
+    std::ofstream costs_file(costs_filename);
     costs_file << dim_x << " " << dim_y << "\n";
     for (int i = 0; i != dim_x * dim_y; ++i) {
-        costs_file << costs[i] << ((i % dim_y == dim_y - 1) ? "\n" : " ");
+        costs_file << board_cost(data, result, i % dim_x, i / dim_x) << ((i % dim_y == dim_y - 1) ? "\n" : " ");
     }
     costs_file.close();
 
     // Write wires
-    std::ofstream wires_file("wires.txt");
+    std::ofstream wires_file(wires_filename);
     wires_file << dim_x << " " << dim_y << "\n"
-               << num_of_wires << "\n";
-    for (int i = 0; i != num_of_wires; ++i)
+               << data.num_of_wires << "\n";
+    for (int i = 0; i != data.num_of_wires; ++i)
         wires_file << routes[i] << "\n";
     wires_file.close();
 
-    return 0;
+    return costs_file && wires_file;
 }
 
 Metrics walk_a_line(Data data, Result result, Point p1, Point p2, int cost_change) {
     assert(p1.x == p2.x || p1.y == p2.y);
 
-    Metrics metrics_of_line;
-
-    if (p1 == p2)
-        return metrics_of_line;
-
-    if (p1.x == p2.x) {
-        for (int y = p1.y; y != p2.y; y += signY(p1, p2)) {
-            int costsIdx = y * data.dim_x + p1.x;
-            result.costs[costsIdx] += cost_change;
-            metrics_of_line.update(result.costs[costsIdx]);
-        }
-    } else {
-        for (int x = p1.x; x != p2.x; x += signX(p1, p2)) {
-            int costsIdx = p1.y * data.dim_x + x;
-            result.costs[costsIdx] += cost_change;
-            metrics_of_line.update(result.costs[costsIdx]);
-        }
+    switch (cost_change) {
+    case 1:
+        return walk_board_segment<WALK_ADD>(data, result, p1, p2);
+    case -1:
+        return walk_board_segment<WALK_REMOVE>(data, result, p1, p2);
+    default:
+        assert(cost_change == 0);
+        return walk_board_segment<WALK_SCORE>(data, result, p1, p2);
     }
-    return metrics_of_line;
 }
 
 Metrics walk_a_route(Data data, Result result, Route route, int cost_change) {
-    Metrics metrics_of_route;
-
-    metrics_of_route.update(walk_a_line(data, result, route.wire.start, route.p1, cost_change));
-    metrics_of_route.update(walk_a_line(data, result, route.p1, route.p2, cost_change));
-    metrics_of_route.update(walk_a_line(data, result, route.p2, route.wire.end, cost_change));
-    // arrive at terminal point
-    int costsIdx = route.wire.end.y * data.dim_x + route.wire.end.x;
-    result.costs[costsIdx] += cost_change;
-    metrics_of_route.update(result.costs[costsIdx]);
-
-    return metrics_of_route;
+    switch (cost_change) {
+    case 1:
+        return walk_board_route<WALK_ADD>(data, result, route);
+    case -1:
+        return walk_board_route<WALK_REMOVE>(data, result, route);
+    default:
+        assert(cost_change == 0);
+        return walk_board_route<WALK_SCORE>(data, result, route);
+    }
 }
 
 Metrics walk_all_routes(Data data, Result result, int cost_change) {
@@ -224,7 +509,394 @@ Metrics walk_all_routes(Data data, Result result, int cost_change) {
     return metrics_of_all_routes;
 }
 
-inline bool is_random_route(Data data) { return (rand() % 100) <= (data.SA_prob * 100); }
+// Same as walk_a_route, but safe against concurrent walks of other threads
+Metrics walk_a_route_atomic(Data data, Result result, Route route, int cost_change) {
+    switch (cost_change) {
+    case 1:
+        return walk_board_route<WALK_ATOMIC_ADD>(data, result, route);
+    case -1:
+        return walk_board_route<WALK_ATOMIC_REMOVE>(data, result, route);
+    default:
+        assert(cost_change == 0);
+        return walk_board_route<WALK_ATOMIC_SCORE>(data, result, route);
+    }
+}
+
+// Scores every candidate of a wire in the order of prepare_all_routes.
+// Vertical-first candidates share the start and end columns and differ only in
+// the row they cross on, so both columns are folded into prefix / suffix
+// metrics once and each row is walked once; likewise for horizontal-first.
+template <class Objective>
+void score_candidates_sweep(Data data, Result result, Wire wire, Metrics *scores, bool parallel) {
+    int h = abs(wire.end.y - wire.start.y), w = abs(wire.end.x - wire.start.x);
+    int dir_x = wire.signX(), dir_y = wire.signY();
+    Metrics end_metrics;
+    Objective::update(end_metrics, board_cost(data, result, wire.end.x, wire.end.y));
+
+    // prefix[k]: first k cells walked from the start, suffix[k]: cells k.. up to the end
+    std::vector<Metrics> prefix(std::max(h, w) + 1), suffix(std::max(h, w) + 1);
+
+    if (h != 0) {
+        for (int k = 0; k < h; ++k) {
+            prefix[k + 1] = prefix[k];
+            Objective::update(prefix[k + 1], board_cost(data, result, wire.start.x, wire.start.y + k * dir_y));
+        }
+        suffix[h] = Metrics();
+        for (int k = h - 1; k >= 0; --k) {
+            suffix[k] = suffix[k + 1];
+            Objective::update(suffix[k], board_cost(data, result, wire.end.x, wire.start.y + k * dir_y));
+        }
+#pragma omp parallel for schedule(static) if (parallel)
+        for (int k = 0; k < h; ++k) {
+            int y = wire.start.y + k * dir_y;
+            Metrics metrics = walk_board_line<AXIS_X, WALK_SCORE, Objective>(data, result, {wire.start.x, y}, {wire.end.x, y});
+            metrics.update(prefix[k]);
+            metrics.update(suffix[k]);
+            metrics.update(end_metrics);
+            scores[k] = metrics;
+        }
+    }
+
+    if (w != 0) {
+        for (int k = 0; k < w; ++k) {
+            prefix[k + 1] = prefix[k];
+            Objective::update(prefix[k + 1], board_cost(data, result, wire.start.x + k * dir_x, wire.start.y));
+        }
+        suffix[w] = Metrics();
+        for (int k = w - 1; k >= 0; --k) {
+            suffix[k] = suffix[k + 1];
+            Objective::update(suffix[k], board_cost(data, result, wire.start.x + k * dir_x, wire.end.y));
+        }
+#pragma omp parallel for schedule(static) if (parallel)
+        for (int k = 0; k < w; ++k) {
+            int x = wire.start.x + k * dir_x;
+            Metrics metrics = walk_board_line<AXIS_Y, WALK_SCORE, Objective>(data, result, {x, wire.start.y}, {x, wire.end.y});
+            metrics.update(prefix[k]);
+            metrics.update(suffix[k]);
+            metrics.update(end_metrics);
+            scores[h + k] = metrics;
+        }
+    }
+}
+
+Regions make_regions(Data data) {
+    int dim_x = (data.dim_x + REGION_SIZE - 1) / REGION_SIZE;
+    int dim_y = (data.dim_y + REGION_SIZE - 1) / REGION_SIZE;
+    unsigned *versions = (unsigned *)calloc(dim_x * dim_y, sizeof(unsigned));
+    return {dim_x, dim_y, versions};
+}
+
+// Calls f with the version of every region under the bounding box of a wire,
+// in row-major order
+template <typename F>
+static void for_each_region(Regions regions, Wire wire, F f) {
+    int x_begin = std::min(wire.start.x, wire.end.x) / REGION_SIZE;
+    int x_end = std::max(wire.start.x, wire.end.x) / REGION_SIZE;
+    int y_begin = std::min(wire.start.y, wire.end.y) / REGION_SIZE;
+    int y_end = std::max(wire.start.y, wire.end.y) / REGION_SIZE;
+
+    for (int y = y_begin; y <= y_end; ++y)
+        for (int x = x_begin; x <= x_end; ++x)
+            f(&regions.versions[y * regions.dim_x + x]);
+}
+
+// Every candidate route of a wire stays inside its bounding box, and versions
+// only grow, so two equal sums of the versions under the box bracket scoring
+// that no commit overlapped. Waits out commits writing under the box (odd
+// versions), so the sum is only ever taken between commits.
+unsigned read_regions(Regions regions, Wire wire) {
+    for (;;) {
+        unsigned stamp = 0;
+        bool writing = false;
+        for_each_region(regions, wire, [&](unsigned *version) {
+            unsigned value = __atomic_load_n(version, __ATOMIC_SEQ_CST);
+            writing |= value & 1;
+            stamp += value;
+        });
+        if (!writing)
+            return stamp;
+    }
+}
+
+// Takes every region under the box of a wire for writing, making its version
+// odd, and returns the sum of the versions before. Regions are taken in
+// row-major order, so commits over overlapping boxes never wait in a cycle.
+unsigned lock_regions(Regions regions, Wire wire) {
+    unsigned stamp = 0;
+    for_each_region(regions, wire, [&](unsigned *version) {
+        unsigned value = __atomic_load_n(version, __ATOMIC_RELAXED);
+        while ((value & 1) || !__atomic_compare_exchange_n(version, &value, value + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            value = __atomic_load_n(version, __ATOMIC_RELAXED);
+        stamp += value;
+    });
+    return stamp;
+}
+
+// Releases the regions taken by lock_regions. Their versions move on to the
+// next even value when costs were written under them, else fall back to the
+// value before the lock, since no reader can tell the two states apart.
+void unlock_regions(Regions regions, Wire wire, bool written) {
+    for_each_region(regions, wire, [&](unsigned *version) {
+        if (written)
+            __atomic_add_fetch(version, 1, __ATOMIC_SEQ_CST);
+        else
+            __atomic_sub_fetch(version, 1, __ATOMIC_SEQ_CST);
+    });
+}
+
+// Calls f with the index of every REGION_SIZE tile covering [p1, p2) of an
+// axis-aligned segment; tiles_x is the number of tiles per grid row
+template <typename F>
+static void for_each_tile(int tiles_x, Point p1, Point p2, F f) {
+    if (p1 == p2)
+        return;
+    // p2 itself is excluded, so stop at the tile of the last cell before it
+    Point last = p1.x == p2.x ? Point{p2.x, p2.y - signY(p1, p2)} : Point{p2.x - signX(p1, p2), p2.y};
+    int x_begin = std::min(p1.x, last.x) / REGION_SIZE, x_end = std::max(p1.x, last.x) / REGION_SIZE;
+    int y_begin = std::min(p1.y, last.y) / REGION_SIZE, y_end = std::max(p1.y, last.y) / REGION_SIZE;
+    for (int y = y_begin; y <= y_end; ++y) {
+        for (int x = x_begin; x <= x_end; ++x)
+            f(y * tiles_x + x);
+    }
+}
+
+// Same as for_each_tile over all cells of a route, stopping early once f returns true
+template <typename F>
+static bool any_route_tile(int tiles_x, const Route &route, F f) {
+    bool found = false;
+    auto visit = [&](int tile) { found = found || f(tile); };
+    Point end = route.wire.end;
+    for_each_tile(tiles_x, route.wire.start, route.p1, visit);
+    if (!found)
+        for_each_tile(tiles_x, route.p1, route.p2, visit);
+    if (!found)
+        for_each_tile(tiles_x, route.p2, end, visit);
+    if (!found)
+        for_each_tile(tiles_x, end, {end.x + 1, end.y}, visit);
+    return found;
+}
+
+WireIndex build_wire_index(Data data, Result result) {
+    WireIndex index;
+    index.dim_x = (data.dim_x + REGION_SIZE - 1) / REGION_SIZE;
+    index.dim_y = (data.dim_y + REGION_SIZE - 1) / REGION_SIZE;
+    index.wires_of_tile.resize(index.dim_x * index.dim_y);
+
+    for (int wire_id = 0; wire_id != data.num_of_wires; wire_id++) {
+        any_route_tile(index.dim_x, result.routes[wire_id], [&](int tile) {
+            std::vector<int> &wires_of_tile = index.wires_of_tile[tile];
+            // wires are indexed in order, so a duplicate can only be the last entry
+            if (wires_of_tile.empty() || wires_of_tile.back() != wire_id)
+                wires_of_tile.push_back(wire_id);
+            return false;
+        });
+    }
+    return index;
+}
+
+// Picks the hotspot_fraction most congested tiles (by max, then sum of cost)
+// and returns the ids of the wires crossing any of them, in ascending order
+std::vector<int> select_hotspot_wires(Data data, Result result, const WireIndex &index, double hotspot_fraction) {
+    int num_of_tiles = index.dim_x * index.dim_y;
+    std::vector<Metrics> tile_metrics(num_of_tiles);
+
+#pragma omp parallel for schedule(static)
+    for (int tile_y = 0; tile_y < index.dim_y; ++tile_y) {
+        int y_end = std::min((tile_y + 1) * REGION_SIZE, data.dim_y);
+        for (int y = tile_y * REGION_SIZE; y < y_end; ++y) {
+            for (int x = 0; x < data.dim_x; ++x)
+                tile_metrics[tile_y * index.dim_x + x / REGION_SIZE].update(board_cost(data, result, x, y));
+        }
+    }
+
+    std::vector<int> tiles(num_of_tiles);
+    for (int i = 0; i < num_of_tiles; ++i)
+        tiles[i] = i;
+    int num_of_hotspots = std::min(num_of_tiles, std::max(1, int(hotspot_fraction * num_of_tiles + 0.5)));
+    std::partial_sort(tiles.begin(), tiles.begin() + num_of_hotspots, tiles.end(), [&](int lhs, int rhs) {
+        return tile_metrics[rhs] < tile_metrics[lhs];
+    });
+
+    std::vector<char> selected(data.num_of_wires, 0);
+    for (int i = 0; i < num_of_hotspots; ++i) {
+        for (int wire_id : index.wires_of_tile[tiles[i]])
+            selected[wire_id] = 1;
+    }
+
+    std::vector<int> wire_ids;
+    for (int wire_id = 0; wire_id != data.num_of_wires; wire_id++) {
+        if (selected[wire_id])
+            wire_ids.push_back(wire_id);
+    }
+    return wire_ids;
+}
+
+CandidateCache make_candidate_cache(Data data, int k) {
+    CandidateCache cache;
+    cache.k = k;
+    cache.epoch = 1;
+    cache.tiles_x = (data.dim_x + REGION_SIZE - 1) / REGION_SIZE;
+    int num_of_tiles = cache.tiles_x * ((data.dim_y + REGION_SIZE - 1) / REGION_SIZE);
+    cache.tile_epochs.assign(num_of_tiles, 0);
+    cache.tile_writers.assign(num_of_tiles, -1);
+    cache.tile_other_epochs.assign(num_of_tiles, 0);
+    cache.stamps.assign(data.num_of_wires, 0);
+    cache.route_ids.assign((size_t)data.num_of_wires * k, -1);
+    cache.metrics.resize((size_t)data.num_of_wires * k);
+    cache.thresholds.resize(data.num_of_wires);
+    cache.scored_candidates = cache.total_candidates = 0;
+    return cache;
+}
+
+// Marks every tile as written by no wire in particular, so each wire is fully
+// rescored the next time it is routed
+void invalidate_candidate_cache(CandidateCache &cache) {
+    unsigned epoch = ++cache.epoch;
+    std::fill(cache.tile_epochs.begin(), cache.tile_epochs.end(), epoch);
+    std::fill(cache.tile_writers.begin(), cache.tile_writers.end(), -1);
+    std::fill(cache.tile_other_epochs.begin(), cache.tile_other_epochs.end(), epoch);
+}
+
+// Adds a route to (or removes it from) the costs and marks its tiles as written
+static void commit_route(Data data, Result result, CandidateCache *cache, int wire_id, Route route, int cost_change) {
+    walk_a_route(data, result, route, cost_change);
+    if (result.negotiated)
+        walk_a_route(data, {result.negotiated, result.routes, nullptr, nullptr}, route, cost_change);
+    if (cache) {
+        unsigned epoch = ++cache->epoch;
+        any_route_tile(cache->tiles_x, route, [&](int tile) {
+            if (cache->tile_writers[tile] != wire_id) {
+                cache->tile_other_epochs[tile] = cache->tile_epochs[tile];
+                cache->tile_writers[tile] = wire_id;
+            }
+            cache->tile_epochs[tile] = epoch;
+            return false;
+        });
+    }
+}
+
+// Returns the best candidate of a wire, rescoring only candidates that cross a
+// tile written since the wire was last scored. Every candidate outside the
+// cached top-k scored no better than the wire's threshold at that time, so a
+// clean cached entry bounds all clean uncached ones and the best is exact.
+template <class Objective>
+static Route best_route_cached(Data data, Result result, CandidateCache &cache, int wire_id, const std::vector<Route> &routes, bool parallel) {
+    size_t routes_len = routes.size();
+    unsigned stamp = cache.stamps[wire_id];
+    int *route_ids = &cache.route_ids[(size_t)wire_id * cache.k];
+    Metrics *metrics = &cache.metrics[(size_t)wire_id * cache.k];
+    auto is_dirty = [&](const Route &route) {
+        return any_route_tile(cache.tiles_x, route, [&](int tile) {
+            unsigned epoch = cache.tile_writers[tile] == wire_id ? cache.tile_other_epochs[tile] : cache.tile_epochs[tile];
+            return epoch > stamp;
+        });
+    };
+
+    bool reuse = false;
+    for (int i = 0; i < cache.k && !reuse; ++i)
+        reuse = route_ids[i] >= 0 && !is_dirty(routes[route_ids[i]]);
+
+    std::vector<Metrics> &scores = cache.scores;
+    std::vector<char> &known = cache.known;
+    scores.resize(routes_len);
+    known.resize(routes_len);
+
+    long scored = 0;
+    if (!reuse && data.sweep_evaluator) {
+        score_candidates_sweep<Objective>(data, result, data.wires[wire_id], scores.data(), parallel);
+        std::fill(known.begin(), known.end(), 1);
+        scored = routes_len;
+    } else {
+#pragma omp parallel for schedule(guided) if (parallel) reduction(+ \
+                                                                   : scored)
+        for (size_t route_id = 0; route_id < routes_len; ++route_id) {
+            known[route_id] = !reuse || is_dirty(routes[route_id]);
+            if (known[route_id]) {
+                scores[route_id] = walk_board_route<WALK_SCORE, Objective>(data, result, routes[route_id]);
+                scored += 1;
+            }
+        }
+    }
+    cache.scored_candidates += scored;
+    cache.total_candidates += routes_len;
+
+    std::vector<int> candidates;
+    for (int i = 0; i < cache.k && reuse; ++i) {
+        if (route_ids[i] >= 0 && !known[route_ids[i]]) {
+            scores[route_ids[i]] = metrics[i];
+            known[route_ids[i]] = 1;
+        }
+    }
+    for (size_t route_id = 0; route_id < routes_len; ++route_id) {
+        // anything above the old threshold may rank below an unscored candidate
+        if (known[route_id] && !(reuse && Objective::less(cache.thresholds[wire_id], scores[route_id])))
+            candidates.push_back(route_id);
+    }
+
+    Route best_route; // Route() has max cost
+    if (candidates.empty())
+        return best_route;
+
+    auto by_score = [&](int lhs, int rhs) {
+        if (Objective::less(scores[lhs], scores[rhs]) || Objective::less(scores[rhs], scores[lhs]))
+            return Objective::less(scores[lhs], scores[rhs]);
+        return lhs < rhs;
+    };
+    size_t cached = std::min(candidates.size(), (size_t)cache.k);
+    std::partial_sort(candidates.begin(), candidates.begin() + cached, candidates.end(), by_score);
+
+    cache.stamps[wire_id] = cache.epoch;
+    for (int i = 0; i < cache.k; ++i) {
+        route_ids[i] = i < (int)cached ? candidates[i] : -1;
+        if (i < (int)cached)
+            metrics[i] = scores[candidates[i]];
+    }
+    cache.thresholds[wire_id] = scores[candidates[cached - 1]];
+
+    best_route = routes[candidates[0]];
+    best_route.metrics = scores[candidates[0]];
+    return best_route;
+}
+
+// First candidate with the lowest metrics, scored by score_candidates_sweep
+template <class Objective>
+static Route best_route_sweep(Data data, Result result, Wire wire, const std::vector<Route> &routes, bool parallel) {
+    std::vector<Metrics> scores(routes.size());
+    score_candidates_sweep<Objective>(data, result, wire, scores.data(), parallel);
+
+    Route best_route; // Route() has max cost
+    for (size_t route_id = 0; route_id < routes.size(); ++route_id) {
+        if (Objective::less(scores[route_id], best_route.metrics)) {
+            best_route = routes[route_id];
+            best_route.metrics = scores[route_id];
+        }
+    }
+    return best_route;
+}
+
+// Best candidate of a wire under Objective, through the cache or evaluator in use
+template <class Objective>
+static Route best_route_of(Data data, Result result, CandidateCache *cache, int wire_id, const std::vector<Route> &routes, bool parallel) {
+    if (cache)
+        return best_route_cached<Objective>(data, result, *cache, wire_id, routes, parallel);
+    if (data.sweep_evaluator)
+        return best_route_sweep<Objective>(data, result, data.wires[wire_id], routes, parallel);
+
+#pragma omp declare reduction(min_route:Route \
+                              : omp_out = Objective::less(omp_in.metrics, omp_out.metrics) ? omp_in : omp_out)
+
+    size_t routes_len = routes.size();
+    Route best_route; // Route() has max cost
+#pragma omp parallel for schedule(guided) if (parallel) reduction(min_route \
+                                                                   : best_route)
+    for (size_t route_id = 0; route_id < routes_len; ++route_id) {
+        Route new_route = routes[route_id];
+        new_route.metrics = walk_board_route<WALK_SCORE, Objective>(data, result, new_route);
+        if (Objective::less(new_route.metrics, best_route.metrics))
+            best_route = new_route;
+    }
+    return best_route;
+}
 
 void solve_all_metrics(Data data, Result result, const std::vector<Route> &routes) {
     // std::vector<Route> routes;// = aroutes;
@@ -238,40 +910,144 @@ void solve_all_metrics(Data data, Result result, const std::vector<Route> &route
     }
 }
 
-void wire_routing(Data data, Result result, const std::vector<std::vector<Route>> &possible_routes) {
-    for (int wire_id = 0; wire_id < data.num_of_wires; wire_id++) {
+void wire_routing(Data data, Result result, const std::vector<std::vector<Route>> &possible_routes, const std::vector<int> &wire_ids, CandidateCache *cache) {
+    for (int wire_id : wire_ids) {
+        // a zero length wire has no candidates and keeps its single cell route
+        if (possible_routes[wire_id].empty())
+            continue;
+
         Wire wire = data.wires[wire_id];
         Route prev_route = result.routes[wire_id];
-        prev_route.metrics = walk_a_route(data, result, prev_route, -1);
+        commit_route(data, result, cache, wire_id, prev_route, -1);
 
         // choose a random path
-        if (is_random_route(data)) {
+        if (is_random_route(data.SA_prob)) {
             Route route(wire);
-            route = generate_random_route(data, wire);
+            route = generate_random_route(wire);
             result.routes[wire_id] = route;
-            walk_a_route(data, result, route, 1);
+            commit_route(data, result, cache, wire_id, route, 1);
             continue;
         }
 
         const std::vector<Route> &routes = possible_routes[wire_id];
+        Route best_route = with_objective(data.objective, [&](auto objective) {
+            return best_route_of<decltype(objective)>(data, result, cache, wire_id, routes, true);
+        });
 
-#pragma omp declare reduction(min_route:Route \
-                              : omp_out = omp_in.metrics < omp_out.metrics ? omp_in : omp_out)
+        commit_route(data, result, cache, wire_id, best_route, 1);
+        result.routes[wire_id] = best_route;
+    }
+}
 
-        size_t routes_len = routes.size();
-        Route best_route; // Route() has max cost
-#pragma omp parallel for schedule(guided) reduction(min_route \
-                                                    : best_route)
-        for (size_t route_id = 0; route_id < routes_len; ++route_id) {
-            Route new_route = routes[route_id];
-            new_route.metrics = walk_a_route(data, result, new_route, 0);
-            if (new_route.metrics < best_route.metrics)
-                best_route = new_route;
+// Commits a route with lock-free fetch-adds, under the regions of its wire
+static void commit_route_atomic(Data data, Result result, Regions regions, Route route, int cost_change) {
+    lock_regions(regions, route.wire);
+    walk_a_route_atomic(data, result, route, cost_change);
+    unlock_regions(regions, route.wire, true);
+}
+
+// Best candidate of a wire under Objective, read while other threads commit
+template <class Objective>
+static Route best_route_atomic(Data data, Result result, const std::vector<Route> &routes) {
+    Route best_route; // Route() has max cost
+    for (size_t route_id = 0; route_id < routes.size(); ++route_id) {
+        Route new_route = routes[route_id];
+        new_route.metrics = walk_board_route<WALK_ATOMIC_SCORE, Objective>(data, result, new_route);
+        if (Objective::less(new_route.metrics, best_route.metrics))
+            best_route = new_route;
+    }
+    return best_route;
+}
+
+// Rips up and re-routes one wire against the shared costs. The best candidate
+// is committed only if no other commit touched the bounding box of the wire
+// since scoring began, checked with its regions held; otherwise it is
+// re-scored. After OPTIMISTIC_MAX_RETRIES retries the wire is scored and
+// committed with its regions held, which counts as a forced commit.
+static void route_wire_optimistic(Data data, Result result, Regions regions, const std::vector<std::vector<Route>> &possible_routes, int wire_id, OptimisticStats &stats) {
+    // a zero length wire has no candidates and keeps its single cell route
+    if (possible_routes[wire_id].empty())
+        return;
+
+    Wire wire = data.wires[wire_id];
+    Route prev_route = result.routes[wire_id];
+    commit_route_atomic(data, result, regions, prev_route, -1);
+
+    // choose a random path
+    if (is_random_route(data.SA_prob)) {
+        Route route = generate_random_route(wire);
+        result.routes[wire_id] = route;
+        commit_route_atomic(data, result, regions, route, 1);
+        return;
+    }
+
+    const std::vector<Route> &routes = possible_routes[wire_id];
+    auto best_route_now = [&]() {
+        return with_objective(data.objective, [&](auto objective) {
+            return best_route_atomic<decltype(objective)>(data, result, routes);
+        });
+    };
+
+    Route best_route; // Route() has max cost
+    bool validated = false;
+    for (int attempt = 0; attempt <= OPTIMISTIC_MAX_RETRIES && !validated; ++attempt) {
+        unsigned stamp = read_regions(regions, wire);
+        best_route = best_route_now();
+        validated = lock_regions(regions, wire) == stamp;
+        if (!validated) {
+            unlock_regions(regions, wire, false);
+            stats.retries += 1;
         }
+    }
 
-        walk_a_route(data, result, best_route, 1);
-        result.routes[wire_id] = best_route;
+    if (!validated) {
+        lock_regions(regions, wire);
+        best_route = best_route_now();
+        stats.forced_commits += 1;
     }
+    walk_a_route_atomic(data, result, best_route, 1);
+    unlock_regions(regions, wire, true);
+    result.routes[wire_id] = best_route;
+}
+
+// Routes many wires concurrently against the shared costs
+OptimisticStats wire_routing_optimistic(Data data, Result result, Regions regions, const std::vector<std::vector<Route>> &possible_routes, const std::vector<int> &wire_ids) {
+    long retries = 0, forced_commits = 0;
+    size_t wire_ids_len = wire_ids.size();
+
+#pragma omp parallel for schedule(dynamic, 1) reduction(+ \
+                                                       : retries, forced_commits)
+    for (size_t i = 0; i < wire_ids_len; i++) {
+        OptimisticStats stats = {0, 0};
+        route_wire_optimistic(data, result, regions, possible_routes, wire_ids[i], stats);
+        retries += stats.retries;
+        forced_commits += stats.forced_commits;
+    }
+    return {retries, forced_commits};
+}
+
+// Same as wire_routing_optimistic on plain std::threads, the parallel backend
+// of the wireroute-threads build. Wires are handed out one at a time from a
+// shared atomic counter.
+OptimisticStats wire_routing_threads(Data data, Result result, Regions regions, const std::vector<std::vector<Route>> &possible_routes, const std::vector<int> &wire_ids, int num_of_threads) {
+    std::atomic<size_t> next_wire(0);
+    std::atomic<long> retries(0), forced_commits(0);
+
+    auto worker = [&]() {
+        OptimisticStats stats = {0, 0};
+        for (size_t i = next_wire++; i < wire_ids.size(); i = next_wire++)
+            route_wire_optimistic(data, result, regions, possible_routes, wire_ids[i], stats);
+        retries += stats.retries;
+        forced_commits += stats.forced_commits;
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < num_of_threads; ++t)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread &thread : threads)
+        thread.join();
+    return {retries, forced_commits};
 }
 
 std::vector<std::vector<Route>> prepare_all_routes(Data data, Result result) {
@@ -280,23 +1056,10 @@ std::vector<std::vector<Route>> prepare_all_routes(Data data, Result result) {
     for (int wire_id = 0; wire_id != data.num_of_wires; wire_id++) {
         Wire wire = data.wires[wire_id];
 
-        std::vector<Route> routes;
-        routes.reserve(abs(wire.end.y - wire.start.y) + abs(wire.end.x - wire.start.x));
-
-        for (int y = wire.start.y; y != wire.end.y; y += wire.signY()) {
-            Route route(wire);
-            route.p1 = {wire.start.x, y};
-            route.p2 = {wire.end.x, y};
-            routes.push_back(route);
-        }
-
-        for (int x = wire.start.x; x != wire.end.x; x += wire.signX()) {
-            Route route(wire);
-            route.p1 = {x, wire.start.y};
-            route.p2 = {x, wire.end.y};
-            routes.push_back(route);
-        }
-        possible_routes[wire_id] = routes;
+        int num_of_routes = num_of_candidates(wire);
+        possible_routes[wire_id].reserve(num_of_routes);
+        for (int route_id = 0; route_id != num_of_routes; ++route_id)
+            possible_routes[wire_id].push_back(candidate_route(wire, route_id));
     }
     return possible_routes;
 }
@@ -307,73 +1070,233 @@ std::vector<Route> prepare_all_routes_flatten(Data data, Result result) {
     for (int wire_id = 0; wire_id != data.num_of_wires; wire_id++) {
         Wire wire = data.wires[wire_id];
 
-        routes.reserve(routes.size() + abs(wire.end.y - wire.start.y) + abs(wire.end.x - wire.start.x));
-
-        for (int y = wire.start.y; y != wire.end.y; y += wire.signY()) {
-            Route route(wire);
-            route.p1 = {wire.start.x, y};
-            route.p2 = {wire.end.x, y};
-            routes.push_back(route);
-        }
-
-        for (int x = wire.start.x; x != wire.end.x; x += wire.signX()) {
-            Route route(wire);
-            route.p1 = {x, wire.start.y};
-            route.p2 = {x, wire.end.y};
-            routes.push_back(route);
-        }
+        int num_of_routes = num_of_candidates(wire);
+        routes.reserve(routes.size() + num_of_routes);
+        for (int route_id = 0; route_id != num_of_routes; ++route_id)
+            routes.push_back(candidate_route(wire, route_id));
     }
     return routes;
 }
 
-Route generate_random_route(Data data, Wire wire) {
-    Route route(wire);
-
-    int dx = wire.end.x - wire.start.x;
-    int dy = wire.end.y - wire.start.y;
-
-    bool vertical_first = rand() % 2;
-    float p = (rand() % 100) / 100.f;
-
-    if (vertical_first) {
-        route.p1 = {wire.start.x, wire.start.y + int(p * dy)};
-        route.p2 = {wire.end.x, route.p1.y};
-    } else {
-        route.p1 = {wire.start.x + int(p * dx), wire.start.y};
-        route.p2 = {route.p1.x, wire.end.y};
-    }
-    return route;
-}
+void wire_routing_sequential(Data data, Result result, const std::vector<std::vector<Route>> &possible_routes, const std::vector<int> &wire_ids, CandidateCache *cache) {
+    for (int wire_id : wire_ids) {
+        // a zero length wire has no candidates and keeps its single cell route
+        if (possible_routes[wire_id].empty())
+            continue;
 
-void wire_routing_sequential(Data data, Result result, const std::vector<std::vector<Route>> &possible_routes) {
-    for (int wire_id = 0; wire_id < data.num_of_wires; wire_id++) {
         Wire wire = data.wires[wire_id];
         Route prev_route = result.routes[wire_id];
-        prev_route.metrics = walk_a_route(data, result, prev_route, -1);
+        commit_route(data, result, cache, wire_id, prev_route, -1);
 
         // choose a random path
-        if (is_random_route(data)) {
+        if (is_random_route(data.SA_prob)) {
             Route route(wire);
-            route = generate_random_route(data, wire);
+            route = generate_random_route(wire);
             result.routes[wire_id] = route;
-            walk_a_route(data, result, route, 1);
+            commit_route(data, result, cache, wire_id, route, 1);
             continue;
         }
 
-        Route best_route; // Route() has max cost
+        const std::vector<Route> &routes = possible_routes[wire_id];
+        Route best_route = with_objective(data.objective, [&](auto objective) {
+            return best_route_of<decltype(objective)>(data, result, cache, wire_id, routes, false);
+        });
+
+        commit_route(data, result, cache, wire_id, best_route, 1);
+        result.routes[wire_id] = best_route;
+    }
+}
+
+// Rips up and re-routes every wire crossing an overused cell, one carrying more
+// than capacity wires, most congested first by the present metrics of its route.
+// Candidates are scored on the negotiated costs, whose history takes the place
+// of random moves. A wire is re-queued when earlier re-routes of the pass have
+// relieved it, and dropped once it no longer crosses an overused cell. Returns
+// the number of re-routed wires.
+long wire_routing_negotiated(Data data, Result result, const std::vector<std::vector<Route>> &possible_routes, CandidateCache *cache, int capacity, bool parallel) {
+    typedef std::pair<Metrics, int> Entry;
+    auto less_congested = [](const Entry &lhs, const Entry &rhs) {
+        if (lhs.first < rhs.first || rhs.first < lhs.first)
+            return lhs.first < rhs.first;
+        return lhs.second > rhs.second; // lower ids first among equals
+    };
+
+    std::vector<Metrics> congestion(data.num_of_wires);
+#pragma omp parallel for schedule(guided)
+    for (int wire_id = 0; wire_id < data.num_of_wires; ++wire_id)
+        congestion[wire_id] = walk_board_route<WALK_SCORE>(data, result, result.routes[wire_id]);
+
+    std::priority_queue<Entry, std::vector<Entry>, decltype(less_congested)> queue(less_congested);
+    for (int wire_id = 0; wire_id < data.num_of_wires; ++wire_id) {
+        if (congestion[wire_id].max_cost_value > capacity && !possible_routes[wire_id].empty())
+            queue.push(Entry(congestion[wire_id], wire_id));
+    }
+
+    Result scoring = {result.negotiated, result.routes, nullptr, nullptr};
+    long rerouted = 0;
+    while (!queue.empty()) {
+        Entry entry = queue.top();
+        queue.pop();
+        int wire_id = entry.second;
+        Route prev_route = result.routes[wire_id];
+        Metrics current = walk_board_route<WALK_SCORE>(data, result, prev_route);
+        if (current.max_cost_value <= capacity)
+            continue;
+        if (current < entry.first) {
+            queue.push(Entry(current, wire_id));
+            continue;
+        }
 
+        commit_route(data, result, cache, wire_id, prev_route, -1);
         const std::vector<Route> &routes = possible_routes[wire_id];
-        size_t routes_len = routes.size();
+        Route best_route = with_objective(data.objective, [&](auto objective) {
+            return best_route_of<decltype(objective)>(data, scoring, cache, wire_id, routes, parallel);
+        });
+        commit_route(data, result, cache, wire_id, best_route, 1);
+        result.routes[wire_id] = best_route;
+        rerouted += 1;
+    }
+    return rerouted;
+}
 
-        for (size_t route_id = 0; route_id < routes_len; ++route_id) {
-            Route new_route = routes[route_id];
-            new_route.metrics = walk_a_route(data, result, new_route, 0);
-            if (new_route.metrics < best_route.metrics) {
-                best_route = new_route;
+/* Daemon mode: boards stay resident across jobs and connections. Jobs are
+ * one command per line, each answered by a single "ok ..." or "error ..." line:
+ *   load <board> <input_file>         route <board> <iterations>
+ *   move <board> <wire_id> x1 y1 x2 y2 add <board> x1 y1 x2 y2
+ *   metrics <board>                   export <board> <costs_file> <wires_file>
+ *   unload <board>                    quit */
+
+typedef std::map<std::string, std::unique_ptr<Router>> Boards;
+
+// Serves one session until EOF or quit. Returns false on quit.
+static bool serve_session(FILE *in, FILE *out, const RouterOptions &options, Boards &boards) {
+    using namespace std::chrono;
+    typedef std::chrono::high_resolution_clock Clock;
+    typedef std::chrono::duration<double> dsec;
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+    bool running = true;
+    while (running && getline(&line, &line_capacity, in) != -1) {
+        std::istringstream request(line);
+        std::string command, name;
+        request >> command >> name;
+        if (command.empty())
+            continue;
+
+        auto start = Clock::now();
+        auto board = boards.find(name);
+        Router *router = board != boards.end() ? board->second.get() : nullptr;
+        std::ostringstream reply;
+
+        if (command == "quit") {
+            reply << "ok";
+            running = false;
+        } else if (command == "load") {
+            std::string input_filename;
+            request >> input_filename;
+            std::unique_ptr<Router> loaded(new Router(options));
+            if (name.empty() || !loaded->load(input_filename.c_str())) {
+                reply << "error unable to load " << input_filename;
+            } else {
+                reply << "ok " << loaded->num_of_wires() << " wires";
+                boards[name] = std::move(loaded);
             }
+        } else if (!router) {
+            reply << "error unknown board " << name;
+        } else if (command == "route") {
+            int iterations = 0;
+            if (!(request >> iterations) || iterations < 0) {
+                reply << "error invalid iterations";
+            } else {
+                router->route(iterations);
+                reply << "ok " << router->metrics();
+            }
+        } else if (command == "move" || command == "add") {
+            WireChange change = {-1, {0, 0}, {0, 0}};
+            if (command == "move")
+                request >> change.wire_id;
+            request >> change.start.x >> change.start.y >> change.end.x >> change.end.y;
+            if (request && router->apply_changes({change}))
+                reply << "ok " << router->num_of_wires() << " wires";
+            else
+                reply << "error invalid wire";
+        } else if (command == "metrics") {
+            reply << "ok " << router->metrics();
+        } else if (command == "export") {
+            std::string costs_filename, wires_filename;
+            request >> costs_filename >> wires_filename;
+            if (router->export_results(costs_filename, wires_filename))
+                reply << "ok";
+            else
+                reply << "error unable to write " << costs_filename << " or " << wires_filename;
+        } else if (command == "unload") {
+            boards.erase(board);
+            reply << "ok";
+        } else {
+            reply << "error unknown command " << command;
         }
 
-        walk_a_route(data, result, best_route, 1);
-        result.routes[wire_id] = best_route;
+        double job_time = duration_cast<dsec>(Clock::now() - start).count();
+        fprintf(out, "%s (%lf s)\n", reply.str().c_str(), job_time);
+        fflush(out);
+    }
+    free(line);
+    return running;
+}
+
+// Serves stdin when socket_path is "-", else one client at a time on a Unix
+// domain socket until a client sends quit
+int serve_boards(const char *socket_path, const RouterOptions &options) {
+    Boards boards;
+    if (strcmp(socket_path, "-") == 0) {
+        serve_session(stdin, stdout, options, boards);
+        return 0;
     }
-}
\ No newline at end of file
+
+    sockaddr_un address = {};
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "%s: socket path longer than %zu bytes\n", socket_path, sizeof(address.sun_path) - 1);
+        return 1;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (listener < 0 || bind(listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 8) != 0) {
+        perror(socket_path);
+        if (listener >= 0)
+            close(listener);
+        return 1;
+    }
+    // A client hanging up mid-reply must not take the resident boards down
+    signal(SIGPIPE, SIG_IGN);
+
+    bool running = true;
+    while (running) {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0)
+            continue;
+        FILE *in = fdopen(connection, "r");
+        int out_fd = in ? dup(connection) : -1;
+        FILE *out = out_fd >= 0 ? fdopen(out_fd, "w") : NULL;
+        if (!out) {
+            // drop this client, the boards stay up for the next one
+            perror("fdopen");
+            if (out_fd >= 0)
+                close(out_fd);
+            if (in)
+                fclose(in);
+            else
+                close(connection);
+            continue;
+        }
+        running = serve_session(in, out, options, boards);
+        fclose(in);
+        fclose(out);
+    }
+    close(listener);
+    unlink(socket_path);
+    return 0;
+}
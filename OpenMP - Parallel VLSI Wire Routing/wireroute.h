@@ -8,29 +8,10 @@
 #include <algorithm>
 #include <cstdio>
 #include <iostream>
-#include <omp.h>
 #include <string>
 #include <vector>
 
-/* Define the data structure for wire here */
-
-struct Point {
-    int x, y;
-};
-inline bool operator==(const Point &lhs, const Point &rhs) { return lhs.x == rhs.x && lhs.y == rhs.y; }
-inline bool operator!=(const Point &lhs, const Point &rhs) { return !(lhs == rhs); }
-
-inline int signX(const Point &p1, const Point &p2) { return p2.x >= p1.x ? +1 : -1; }
-inline int signY(const Point &p1, const Point &p2) { return p2.y >= p1.y ? +1 : -1; }
-
-struct Wire {
-    Point start, end;
-    inline int signX() { return ::signX(start, end); }
-    inline int signY() { return ::signY(start, end); }
-};
-
-typedef int cost_t;
-#define MAX_COST INT32_MAX
+#include "../Core - Parallel VLSI Wire Routing/routing_core.h"
 
 struct Data {
     int dim_x, dim_y;
@@ -39,68 +20,129 @@ struct Data {
     int num_of_threads;
     double SA_prob;
     int SA_iters;
+    bool sweep_evaluator;
+    ObjectiveKind objective;
 };
 
-struct Metrics {
-    cost_t max_cost_value;
-    cost_t sum_cost_values;
+struct Result {
+    cost_t *costs;
+    Route *routes;
+    SparseGrid *sparse; // replaces costs when set
+    cost_t *negotiated; // present plus history costs candidates are scored on, when set
+};
 
-    Metrics(cost_t max_cost_value = 0, cost_t sum_cost_values = 0) : max_cost_value(max_cost_value), sum_cost_values(sum_cost_values) {}
+/* Coarse version counters over REGION_SIZE x REGION_SIZE blocks of the cost grid */
+#define REGION_SIZE 16
+#define OPTIMISTIC_MAX_RETRIES 4
+/* History cost an overused cell gains per negotiated pass */
+#define HISTORY_COST 1
 
-    void update(cost_t new_cost) {
-        this->max_cost_value = std::max(this->max_cost_value, new_cost);
-        this->sum_cost_values += new_cost;
-    }
+/* A seqlock per region: its version is odd while a commit writes under it */
+struct Regions {
+    int dim_x, dim_y;
+    unsigned *versions;
+};
 
-    void update(Metrics new_metrics) {
-        this->max_cost_value = std::max(this->max_cost_value, new_metrics.max_cost_value);
-        this->sum_cost_values += new_metrics.sum_cost_values;
-    }
+/* Counts of an optimistic pass */
+struct OptimisticStats {
+    long retries;        // scores dropped because a commit overlapped them
+    long forced_commits; // wires scored and committed with their regions held
 };
 
-struct Route {
-    Wire wire;
-    Point p1, p2;
-    Metrics metrics = Metrics{MAX_COST, MAX_COST};
-    Route() {}
-    explicit Route(Wire wire) : wire(wire) {}
+/* Bucketed spatial index from REGION_SIZE tiles to the wires whose current
+ * routes cross them */
+struct WireIndex {
+    int dim_x, dim_y;
+    std::vector<std::vector<int>> wires_of_tile;
 };
 
-struct Result {
-    cost_t *costs;
-    Route *routes;
+/* Per-wire cache of the best k candidate scores. Tiles record the epoch of
+ * their last write, so a candidate is stale iff it crosses a tile newer than
+ * the stamp of its wire. A wire's own route is absent whenever it is scored,
+ * so its own writes cancel out and are tracked apart from everyone else's. */
+struct CandidateCache {
+    int k;
+    unsigned epoch;
+    int tiles_x;
+    std::vector<unsigned> tile_epochs;
+    std::vector<int> tile_writers;
+    std::vector<unsigned> tile_other_epochs; // last write by another wire than tile_writers
+    std::vector<unsigned> stamps;
+    std::vector<int> route_ids;
+    std::vector<Metrics> metrics;
+    std::vector<Metrics> thresholds;
+    // scratch space for rescoring one wire
+    std::vector<Metrics> scores;
+    std::vector<char> known;
+    long scored_candidates, total_candidates;
+};
+
+struct RouterOptions {
+    int num_of_threads;
+    double SA_prob;
+    std::string mode;
+    double hotspot_fraction;
+    int full_sweep_period;
+    int cache_k;
+    bool sweep_evaluator;
+    ObjectiveKind objective;
+    bool sparse_grid;
+    int capacity; // wires a cell carries before it is overused, 0 to disable negotiation
 };
 
-bool operator<(const Metrics &lhs, const Metrics &rhs) {
-    if (lhs.max_cost_value != rhs.max_cost_value)
-        return lhs.max_cost_value < rhs.max_cost_value;
-    return lhs.sum_cost_values < rhs.sum_cost_values;
-}
-
-std::ostream &operator<<(std::ostream &os, const Metrics &metrics) {
-    os << "Max cost: " << metrics.max_cost_value << ", Sum cost: " << metrics.sum_cost_values << "";
-    return os;
-}
-
-std::ostream &operator<<(std::ostream &os, const Point &p) {
-    os << p.x << " " << p.y;
-    return os;
-}
-
-std::ostream &operator<<(std::ostream &os, const Wire &wire) {
-    os << wire.start << " " << wire.end;
-    return os;
-}
-
-std::ostream &operator<<(std::ostream &os, const Route &route) {
-    os << route.wire.start << " ";
-    if (route.p1 != route.wire.start)
-        os << route.p1 << " ";
-    if (route.p2 != route.p1)
-        os << route.p2 << " ";
-    os << route.wire.end;
-    return os;
-}
+struct RouterStats {
+    long optimistic_retries;
+    long forced_commits;
+    long rerouted_wires;
+    long scored_candidates, total_candidates;
+};
+
+/* Moves wire_id to new terminals, or appends a wire when wire_id is -1 */
+struct WireChange {
+    int wire_id;
+    Point start, end;
+};
+
+/* A board kept resident between jobs. The netlist, cost grid, routes and the
+ * structures derived from them are built once by load, so later route calls
+ * and incremental changes pay only for the routing itself. */
+class Router {
+  public:
+    explicit Router(const RouterOptions &options);
+    ~Router();
+    Router(const Router &) = delete;
+    Router &operator=(const Router &) = delete;
+
+    bool load(const char *input_filename);
+    void route(int iterations);
+    bool apply_changes(const std::vector<WireChange> &changes);
+    Metrics metrics() const;
+    bool export_results(const std::string &costs_filename, const std::string &wires_filename) const;
+    RouterStats stats() const { return totals; }
+    int num_of_wires() const { return data.num_of_wires; }
+    int num_of_tiles() const { return grid.tiles_x * grid.tiles_y; }
+    int allocated_tiles() const;
+
+  private:
+    void refresh();
+    long route_negotiated();
+
+    RouterOptions options;
+    Data data;
+    Result result;
+    std::vector<Wire> wires;
+    std::vector<Route> routes;
+    std::vector<cost_t> costs;
+    std::vector<cost_t> history;
+    std::vector<cost_t> negotiated;
+    SparseGrid grid;
+    std::vector<std::vector<Route>> possible_routes;
+    std::vector<int> all_wire_ids;
+    Regions regions;
+    CandidateCache cache;
+    RouterStats totals;
+    int iteration; // counts across route calls, so full sweeps keep their period
+};
 
 const char *get_option_string(const char *option_name,
                               const char *default_value);
@@ -110,14 +152,32 @@ float get_option_float(const char *option_name, float default_value);
 Metrics walk_a_line(Data data, Result result, Point p1, Point p2, int cost_change);
 Metrics walk_a_route(Data data, Result result, Route route, int cost_change);
 Metrics walk_all_routes(Data data, Result result, int cost_change);
+Metrics walk_a_route_atomic(Data data, Result result, Route route, int cost_change);
+
+template <class Objective>
+void score_candidates_sweep(Data data, Result result, Wire wire, Metrics *scores, bool parallel);
 
-void wire_routing(Data data, Result result, const std::vector<std::vector<Route>> &possible_routes);
-void wire_routing_sequential(Data data, Result result, const std::vector<std::vector<Route>> &possible_routes);
+Regions make_regions(Data data);
+unsigned read_regions(Regions regions, Wire wire);
+unsigned lock_regions(Regions regions, Wire wire);
+void unlock_regions(Regions regions, Wire wire, bool written);
+
+void wire_routing(Data data, Result result, const std::vector<std::vector<Route>> &possible_routes, const std::vector<int> &wire_ids, CandidateCache *cache);
+void wire_routing_sequential(Data data, Result result, const std::vector<std::vector<Route>> &possible_routes, const std::vector<int> &wire_ids, CandidateCache *cache);
+OptimisticStats wire_routing_optimistic(Data data, Result result, Regions regions, const std::vector<std::vector<Route>> &possible_routes, const std::vector<int> &wire_ids);
+OptimisticStats wire_routing_threads(Data data, Result result, Regions regions, const std::vector<std::vector<Route>> &possible_routes, const std::vector<int> &wire_ids, int num_of_threads);
+long wire_routing_negotiated(Data data, Result result, const std::vector<std::vector<Route>> &possible_routes, CandidateCache *cache, int capacity, bool parallel);
 void solve_all_metrics(Data data, Result result, const std::vector<Route> &routes);
 
+CandidateCache make_candidate_cache(Data data, int k);
+void invalidate_candidate_cache(CandidateCache &cache);
+
+WireIndex build_wire_index(Data data, Result result);
+std::vector<int> select_hotspot_wires(Data data, Result result, const WireIndex &index, double hotspot_fraction);
+
 std::vector<std::vector<Route>> prepare_all_routes(Data data, Result result);
 std::vector<Route> prepare_all_routes_flatten(Data data, Result result);
 
-Route generate_random_route(Data input_data, Wire wire);
+int serve_boards(const char *socket_path, const RouterOptions &options);
 
 #endif